@@ -0,0 +1,205 @@
+#include "app.hpp"
+
+#include <glm/glm.hpp>
+#include <glad/gl.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// deterministic frame time benchmark. every scene and toggle combination flies the same scripted
+// camera path with the animation time taken from the frame index, warmup frames are dropped and
+// the measured frame times are summarised as json
+
+struct Result {
+	int scene;
+	bool reflections;
+	bool lighting;
+	bool shadows;
+	int bounces;
+	std::vector<double> times; // ms
+	long long nodes = 0; // bvh nodes visited over the measured frames, cpu only
+};
+
+// nearest rank on sorted times
+double percentile(const std::vector<double>& sorted, double p) {
+	int rank = (int)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::clamp(rank - 1, 0, (int)sorted.size() - 1)];
+}
+
+// slow sweep around the default view, a function of the frame index only
+void flyCamera(int frame, int frames) {
+	const float pi = 3.1415926f;
+	float u = frames > 1 ? (float)frame / (float)(frames - 1) : 0.0f;
+	app.camera.position = glm::vec3(4.0f * sin(2.0f*pi*u), 2.0f * sin(4.0f*pi*u), -5.0f * u);
+	app.camera.yaw = -90.0 + 20.0 * sin(2.0*pi*u);
+	app.camera.pitch = -5.0 * sin(2.0*pi*u);
+	app.camera.orient();
+}
+
+double renderFrame(int frame, long long* nodes = nullptr) {
+	auto start = std::chrono::steady_clock::now();
+	app.renderer.time = frame / 60.0f;
+	app.deltaTime = 0.0f;
+	if (app.cpu) {
+		app.tracer.update(app.deltaTime);
+		app.tracer.draw();
+		if (nodes) {
+			*nodes += app.tracer.nodesVisited;
+		}
+	} else {
+		app.renderer.update();
+		app.renderer.draw();
+		glFinish();
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<int> parseList(std::string list) {
+	std::vector<int> values;
+	std::stringstream stream(list);
+	std::string value;
+	while (std::getline(stream, value, ',')) {
+		values.push_back(std::max(1, std::stoi(value)));
+	}
+	return values;
+}
+
+int main(int argc, char** argv) {
+	int warmup = 10;
+	int measure = 60;
+	unsigned int seed = 1;
+	std::vector<int> bounceCounts = {4, 20};
+	std::string json = "";
+
+	// bench options are handled here, everything else (--cpu, --size, --scene, --threads, ...) goes to the app
+	std::vector<char*> rest = {argv[0]};
+	for (int i=1;i<argc;i++) {
+		std::string arg = argv[i];
+		bool hasValue = i+1 < argc;
+		if (arg == "--warmup" && hasValue) {
+			warmup = std::max(0, std::stoi(argv[++i]));
+		} else if (arg == "--measure" && hasValue) {
+			measure = std::max(1, std::stoi(argv[++i]));
+		} else if (arg == "--bounces" && hasValue) {
+			bounceCounts = parseList(argv[++i]);
+		} else if (arg == "--seed" && hasValue) {
+			seed = std::stoul(argv[++i]);
+		} else if (arg == "--json" && hasValue) {
+			json = argv[++i];
+		} else {
+			rest.push_back(argv[i]);
+		}
+	}
+
+	app.width = 640;
+	app.height = 360;
+	app.parse(rest.size(), rest.data());
+	if (!app.cpu) {
+		app.headless = true;
+	}
+	app.init();
+
+	std::string device;
+	if (app.cpu) {
+		device = std::string(app.tracer.kernels->name) + " x" + std::to_string(app.tracer.threads);
+	} else {
+		device = (const char*)glGetString(GL_RENDERER);
+	}
+
+	std::vector<Result> results;
+	for (int id=app.firstScene;id<=app.lastScene;id++) {
+		for (int toggles=0;toggles<8;toggles++) {
+			for (int b=0;b<bounceCounts.size();b++) {
+				// every combination starts from the freshly loaded scene, with the bvh's refit count and
+				// the occluder cache reset, so its timings don't depend on the combinations before it
+				std::srand(seed);
+				app.scene.load(id);
+				app.scene.bvh.refits = 0;
+				app.scene.bvh.rebuilds = 0;
+				app.tracer.occluders.clear();
+				if (!app.cpu) {
+					app.renderer.updateBuffers();
+				}
+
+				Result result;
+				result.scene = id;
+				result.reflections = (toggles & 1) != 0;
+				result.lighting = (toggles & 2) != 0;
+				result.shadows = (toggles & 4) != 0;
+				result.bounces = bounceCounts[b];
+				app.renderer.reflections = result.reflections;
+				app.renderer.lighting = result.lighting;
+				app.renderer.shadows = result.shadows;
+				app.renderer.bounces = result.bounces;
+
+				for (int i=0;i<warmup;i++) {
+					flyCamera(0, measure);
+					renderFrame(0);
+				}
+				for (int i=0;i<measure;i++) {
+					flyCamera(i, measure);
+					result.times.push_back(renderFrame(i, &result.nodes));
+				}
+				results.push_back(result);
+
+				std::sort(result.times.begin(), result.times.end());
+				std::cerr << "scene: " << id << ", reflections: " << result.reflections << ", lighting: " << result.lighting;
+				std::cerr << ", shadows: " << result.shadows << ", bounces: " << result.bounces;
+				std::cerr << ", p50: " << std::fixed << std::setprecision(3) << percentile(result.times, 50.0) << " ms" << std::endl;
+			}
+		}
+	}
+
+	std::ofstream file;
+	if (!json.empty()) {
+		file.open(json);
+	}
+	std::ostream& out = json.empty() ? std::cout : file;
+	out << std::fixed << std::setprecision(4);
+	out << "{\n";
+	out << "  \"renderer\": \"" << (app.cpu ? "cpu" : "gl") << "\",\n";
+	out << "  \"device\": \"" << device << "\",\n";
+	out << "  \"width\": " << app.width << ",\n";
+	out << "  \"height\": " << app.height << ",\n";
+	out << "  \"warmup\": " << warmup << ",\n";
+	out << "  \"frames\": " << measure << ",\n";
+	out << "  \"seed\": " << seed << ",\n";
+	out << "  \"accel\": \"" << (app.renderer.accelerator == 0 ? "linear" : app.renderer.accelerator == 2 ? "grid" : app.scene.bvh.wide ? "bvh4" : "bvh2") << "\",\n";
+	out << "  \"results\": [\n";
+	for (int i=0;i<results.size();i++) {
+		Result& result = results[i];
+		double sum = 0.0;
+		for (int j=0;j<result.times.size();j++) {
+			sum += result.times[j];
+		}
+		std::sort(result.times.begin(), result.times.end());
+		out << "    {\"scene\": " << result.scene;
+		out << ", \"reflections\": " << (result.reflections ? "true" : "false");
+		out << ", \"lighting\": " << (result.lighting ? "true" : "false");
+		out << ", \"shadows\": " << (result.shadows ? "true" : "false");
+		out << ", \"bounces\": " << result.bounces;
+		out << ", \"mean\": " << sum / result.times.size();
+		out << ", \"p50\": " << percentile(result.times, 50.0);
+		out << ", \"p95\": " << percentile(result.times, 95.0);
+		out << ", \"p99\": " << percentile(result.times, 99.0);
+		out << ", \"min\": " << result.times.front();
+		out << ", \"max\": " << result.times.back();
+		if (app.cpu) {
+			out << ", \"nodes\": " << result.nodes / result.times.size();
+		}
+		out << "}";
+		out << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n";
+	out << "}\n";
+
+	app.exit();
+	return 0;
+}
@@ -0,0 +1,212 @@
+#include "scene.hpp"
+#include "bvh.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// bvh build and refit timings for a field of bobbing spheres, optionally with only some of them animated,
+// top level rebuilds over bobbing instances of one prefab and sphere grid rebuilds
+
+float rnd(float min, float max) {
+	return min + (float)std::rand() / ((float)RAND_MAX/(max-min));
+}
+
+void fill(Scene& scene, int count, float animated) {
+	std::srand(1);
+	scene.spheres.reserve(count);
+	for (int i=0;i<count;i++) {
+		scene.spheres.push_back(Sphere(glm::vec3(rnd(-100.0f, 100.0f), rnd(-10.0f, 10.0f), rnd(-200.0f, 0.0f)), rnd(0.2f, 1.0f)));
+		if (rnd(0.0f, 1.0f) < animated) {
+			scene.updaters.push_back(new BobUpdater(&scene.spheres.back().position, glm::vec3(0.0f, 1.0f, 0.0f), -5.0f, 5.0f, rnd(0.5f, 2.0f), rnd(0.0f, 6.28f)));
+		}
+	}
+}
+
+// every reference reached once, children inside their parents. returns the depth
+int validate(const BVH& bvh, int node, std::vector<int>& seen, bool& ok) {
+	const BVHNode& n = bvh.nodes[node];
+	if (n.count > 0) {
+		for (int k=n.start;k<n.start+n.count;k++) {
+			seen[k]++;
+		}
+		return 1;
+	}
+	int depth = 0;
+	for (int c=0;c<2;c++) {
+		const BVHNode& child = bvh.nodes[n.start + c];
+		ok = ok && glm::all(glm::lessThanEqual(n.min, child.min)) && glm::all(glm::greaterThanEqual(n.max, child.max));
+		ok = ok && bvh.parents[n.start + c] == node;
+		depth = std::max(depth, validate(bvh, n.start + c, seen, ok));
+	}
+	return depth + 1;
+}
+
+std::string check(const BVH& bvh) {
+	std::vector<int> seen(bvh.references.size(), 0);
+	bool ok = true;
+	int depth = bvh.nodes.empty() ? 0 : validate(bvh, 0, seen, ok);
+	for (int i=0;i<seen.size();i++) {
+		ok = ok && seen[i] == 1;
+	}
+	return std::string(ok ? "ok" : "BROKEN") + ", depth: " + std::to_string(depth);
+}
+
+// the wide nodes reach every reference once and their decoded child boxes hold the binary ones
+std::string checkWide(const BVH& bvh) {
+	std::vector<int> seen(bvh.references.size(), 0);
+	bool ok = true;
+	for (int i=0;i<bvh.wideNodes.size();i++) {
+		const WideNode& node = bvh.wideNodes[i];
+		for (int c=0;c<4;c++) {
+			int child = node.children[c];
+			if (child == -1) {
+				continue;
+			}
+			if (child < 0) {
+				for (int k=child&0x7fffff;k<(child&0x7fffff)+(child>>23&0xff);k++) {
+					seen[k]++;
+				}
+			}
+			const BVHNode& source = bvh.nodes[bvh.wideSources[i*4 + c]];
+			for (int axis=0;axis<3;axis++) {
+				float scale = glm::uintBitsToFloat((node.exponents >> 8*axis & 0xff) << 23);
+				ok = ok && node.origin[axis] + (node.lo[axis] >> 8*c & 0xff) * scale <= source.min[axis];
+				ok = ok && node.origin[axis] + (node.hi[axis] >> 8*c & 0xff) * scale >= source.max[axis];
+			}
+		}
+	}
+	for (int i=0;i<seen.size();i++) {
+		ok = ok && seen[i] == 1;
+	}
+	return ok ? "ok" : "BROKEN";
+}
+
+void refit(int count, float animated, int frames) {
+	Scene scene;
+	fill(scene, count, animated);
+	scene.bvh.wide = true;
+	scene.accelerator = 1;
+	scene.build();
+	BVH& bvh = scene.bvh;
+	float build = bvh.buildTime;
+
+	std::vector<float> times;
+	int refitNodes = 0;
+	for (int i=0;i<frames;i++) {
+		scene.update(i / 60.0f);
+		times.push_back(bvh.refitTime);
+		refitNodes += bvh.refitNodes;
+	}
+	std::sort(times.begin(), times.end());
+	float sum = 0.0f;
+	for (int i=0;i<times.size();i++) {
+		sum += times[i];
+	}
+
+	std::cout << "refit spheres: " << count << ", animated: " << scene.moving.size() << ", nodes: " << bvh.nodes.size();
+	std::cout << ", build: " << build << " ms, refit mean: " << sum / frames << " ms, p50: " << times[frames / 2] << " ms, max: " << times.back() << " ms";
+	std::cout << ", nodes/refit: " << refitNodes / frames << ", rebuilds: " << bvh.rebuilds << ", cost: " << bvh.cost() / bvh.builtCost << "x built";
+	std::cout << ", " << check(bvh) << ", wide: " << checkWide(bvh) << std::endl;
+}
+
+void grid(int count, int frames) {
+	Scene scene;
+	fill(scene, count, 1.0f);
+	scene.accelerator = 2;
+	scene.build();
+	Grid& grid = scene.grid;
+	std::vector<float> times;
+	for (int i=0;i<frames;i++) {
+		scene.update(i / 60.0f);
+		times.push_back(grid.buildTime);
+	}
+	std::sort(times.begin(), times.end());
+	std::cout << "grid spheres: " << count << ", cells: " << grid.resolution.x << "x" << grid.resolution.y << "x" << grid.resolution.z;
+	std::cout << ", buckets: " << grid.buckets << ", entries/sphere: " << (float)grid.entries.size() / count;
+	std::cout << ", rebuild p50: " << times[frames / 2] << " ms, max: " << times.back() << " ms";
+	std::cout << ", bytes: " << (grid.starts.size() + grid.entries.size())*sizeof(int) << std::endl;
+}
+
+void build(int count, int builder, int bits, int threads, int repeats) {
+	Scene scene;
+	fill(scene, count, 0.0f);
+	BVH& bvh = scene.bvh;
+	bvh.wide = true;
+	bvh.builder = builder;
+	bvh.mortonBits = bits;
+	bvh.threads = threads;
+	std::vector<float> times;
+	for (int i=0;i<repeats;i++) {
+		bvh.build(scene.spheres, scene.quads, scene.cubes);
+		times.push_back(bvh.buildTime);
+	}
+	std::sort(times.begin(), times.end());
+	std::cout << "build spheres: " << count << ", builder: " << (builder == BVH::SAH ? "sah" : "morton" + std::to_string(bits));
+	std::cout << ", threads: " << (builder == BVH::SAH ? 1 : bvh.scheduler.threads) << ", nodes: " << bvh.nodes.size();
+	std::cout << ", depth: " << bvh.depth() << (bvh.mortonTooDeep ? " (sah fallback)" : "");
+	std::cout << ", build p50: " << times[repeats / 2] << " ms, cost: " << bvh.cost() << ", " << check(bvh);
+	std::cout << ", wide nodes: " << bvh.wideNodes.size() << ", bytes binary: " << bvh.nodes.size()*sizeof(BVHNode);
+	std::cout << ", wide: " << bvh.wideNodes.size()*sizeof(WideNode) << ", " << checkWide(bvh) << std::endl;
+}
+
+void instanced(int copies, int frames) {
+	Scene scene;
+	scene.instances.reserve(copies);
+	scene.prefabs.push_back(Prefab());
+	for (int i=0;i<64;i++) {
+		scene.prefabs[0].cubes.push_back(Cube(glm::vec3(i%4, i/4%4, i/16) * 2.0f, glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+	}
+	std::srand(1);
+	for (int i=0;i<copies;i++) {
+		scene.instances.push_back(Instance(0, glm::translate(glm::mat4(1.0f), glm::vec3(rnd(-200.0f, 200.0f), rnd(-10.0f, 10.0f), rnd(-400.0f, 0.0f)))));
+		scene.updaters.push_back(new BobUpdater(&scene.instances.back().transform[3], glm::vec3(0.0f, 1.0f, 0.0f), -5.0f, 5.0f, rnd(0.5f, 2.0f), rnd(0.0f, 6.28f)));
+	}
+	scene.build();
+
+	std::vector<float> times;
+	for (int i=0;i<frames;i++) {
+		scene.update(i / 60.0f);
+		times.push_back(scene.tlas.buildTime);
+	}
+	std::sort(times.begin(), times.end());
+
+	// the same geometry flattened into the scene vectors, with about one node per primitive
+	long long instancedBytes = scene.prefabCubes.size()*sizeof(Cube) + scene.prefabNodes.size()*sizeof(BVHNode) + scene.prefabReferences.size()*sizeof(int);
+	instancedBytes += scene.instances.size()*sizeof(Instance) + scene.tlas.nodes.size()*sizeof(BVHNode) + scene.tlas.references.size()*sizeof(int);
+	long long flatBytes = (long long)copies*scene.prefabCubes.size()*(sizeof(Cube) + sizeof(BVHNode) + sizeof(int));
+	std::cout << "instances: " << copies << " x " << scene.prefabCubes.size() << " cubes, top level nodes: " << scene.tlas.nodes.size();
+	std::cout << ", rebuild p50: " << times[frames / 2] << " ms, max: " << times.back() << " ms";
+	std::cout << ", bytes: " << instancedBytes << " instanced, ~" << flatBytes << " flattened, " << check(scene.tlas) << std::endl;
+}
+
+int main(int argc, char** argv) {
+	int count = argc > 1 ? std::atoi(argv[1]) : 10000;
+	int frames = argc > 2 ? std::atoi(argv[2]) : 600;
+	int large = argc > 3 ? std::atoi(argv[3]) : 1000000;
+	int threads = argc > 4 ? std::atoi(argv[4]) : 0;
+	std::cout << std::fixed << std::setprecision(4);
+
+	refit(count, 1.0f, frames);
+	refit(count, 0.1f, frames);
+	refit(count, 0.01f, frames);
+	grid(count, frames);
+	instanced(100, frames);
+	instanced(1000, frames);
+
+	for (int n=count;n<=large;n*=10) {
+		int repeats = n >= 1000000 ? 3 : 9;
+		if (n <= 100000) {
+			build(n, BVH::SAH, 0, 1, repeats);
+		}
+		build(n, BVH::MORTON, 30, threads, repeats);
+		build(n, BVH::MORTON, 63, threads, repeats);
+	}
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include "objects.hpp"
+#include "intersect.hpp"
+#include "packed.hpp"
+#include "simd.hpp"
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// micro-benchmark of the soa kernels against the aos intersectSphere/intersectQuad kernels from res/kernels.glsl
+
+const float near = 0.001f;
+const float far = 10000.0f;
+
+float rnd(float min, float max) {
+	return min + (float)std::rand() / ((float)RAND_MAX/(max-min));
+}
+
+template<typename F>
+double measure(F f) {
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(std::string name, int rays, double seconds, double baseline, int mismatches) {
+	std::cout << std::left << std::setw(28) << name << std::right;
+	std::cout << std::setw(10) << std::fixed << std::setprecision(2) << rays / seconds / 1e6 << " Mrays/s";
+	std::cout << std::setw(8) << std::setprecision(2) << baseline / seconds << "x";
+	if (mismatches >= 0) {
+		std::cout << "  mismatches: " << mismatches;
+	}
+	std::cout << std::endl;
+}
+
+RayLanes toLanes(const Ray* rays) {
+	RayLanes lanes;
+	for (int i=0;i<8;i++) {
+		lanes.ox[i] = rays[i].origin.x; lanes.oy[i] = rays[i].origin.y; lanes.oz[i] = rays[i].origin.z;
+		lanes.dx[i] = rays[i].direction.x; lanes.dy[i] = rays[i].direction.y; lanes.dz[i] = rays[i].direction.z;
+		lanes.ix[i] = rays[i].inverseDirection.x; lanes.iy[i] = rays[i].inverseDirection.y; lanes.iz[i] = rays[i].inverseDirection.z;
+	}
+	return lanes;
+}
+
+int main(int argc, char** argv) {
+	int numRays = argc > 1 ? std::atoi(argv[1]) : 1 << 16;
+	int numObjects = argc > 2 ? std::atoi(argv[2]) : 64;
+	numRays = (numRays + 7) / 8 * 8;
+
+	std::vector<Sphere> spheres;
+	std::vector<Quad> quads;
+	for (int i=0;i<numObjects;i++) {
+		spheres.push_back(Sphere(glm::vec3(rnd(-50.0f, 50.0f), rnd(-50.0f, 50.0f), rnd(-150.0f, -50.0f)), rnd(1.0f, 6.0f)));
+		glm::vec3 e1 = glm::vec3(rnd(2.0f, 10.0f), 0.0f, rnd(-2.0f, 2.0f));
+		glm::vec3 e2 = glm::vec3(0.0f, rnd(2.0f, 10.0f), rnd(-2.0f, 2.0f));
+		quads.push_back(Quad(glm::vec3(rnd(-50.0f, 50.0f), rnd(-50.0f, 50.0f), rnd(-150.0f, -50.0f)), e1, e2));
+	}
+	std::vector<Ray> rays;
+	for (int i=0;i<numRays;i++) {
+		rays.push_back(Ray(glm::vec3(rnd(-1.0f, 1.0f), rnd(-1.0f, 1.0f), 0.0f), glm::normalize(glm::vec3(rnd(-0.4f, 0.4f), rnd(-0.4f, 0.4f), -1.0f))));
+	}
+
+	PackedScene packed;
+	packed.pack(spheres, quads, {});
+
+	const Kernels* all[] = {&scalarKernels, &sse4Kernels, &avx2Kernels};
+	std::vector<const Kernels*> kernels;
+	for (const Kernels* k : all) {
+		if (selectKernels(k->name) == k) {
+			kernels.push_back(k);
+		}
+	}
+
+	std::cout << "rays: " << numRays << ", objects: " << numObjects << ", selected: " << selectKernels()->name << std::endl;
+
+	for (int type=0;type<2;type++) {
+		std::string kind = type == 0 ? "sphere" : "quad";
+		std::vector<int> reference(numRays);
+
+		double baseline = measure([&]() {
+			for (int r=0;r<numRays;r++) {
+				float best = far;
+				int index = -1;
+				for (int i=0;i<numObjects;i++) {
+					float t;
+					if (type == 0) {
+						t = intersectSphere(rays[r], spheres[i].position);
+					} else {
+						if (!intersectAABB(rays[r], quads[i].bounds)) {
+							continue;
+						}
+						t = intersectQuad(rays[r], quads[i].position, quads[i].edges[0], quads[i].edges[1], quads[i].normal);
+					}
+					if (t < best && t > near) {
+						best = t;
+						index = i;
+					}
+				}
+				reference[r] = index;
+			}
+		});
+		report(kind + " aos reference", numRays, baseline, baseline, -1);
+
+		for (const Kernels* k : kernels) {
+			std::vector<int> result(numRays);
+			double seconds = measure([&]() {
+				for (int r=0;r<numRays;r++) {
+					float t = far;
+					RayLane lane = toLane(rays[r]);
+					result[r] = type == 0 ? k->nearestSphere(lane, packed.spheres, near, &t) : k->nearestQuad(lane, packed.quads, near, &t);
+				}
+			});
+			int mismatches = 0;
+			for (int r=0;r<numRays;r++) {
+				mismatches += result[r] != reference[r];
+			}
+			report(kind + " 1x" + std::to_string(numObjects) + " " + k->name, numRays, seconds, baseline, mismatches);
+		}
+
+		for (const Kernels* k : kernels) {
+			std::vector<int> result(numRays);
+			double seconds = measure([&]() {
+				for (int r=0;r<numRays;r+=8) {
+					RayLanes lanes = toLanes(&rays[r]);
+					float best[8];
+					for (int j=0;j<8;j++) {
+						best[j] = far;
+						result[r + j] = -1;
+					}
+					for (int i=0;i<numObjects;i++) {
+						float t[8];
+						if (type == 0) {
+							float sphere[4] = {packed.sphereX[i], packed.sphereY[i], packed.sphereZ[i], packed.sphereR[i]};
+							k->sphereRays(lanes, sphere, t);
+						} else {
+							k->quadRays(lanes, packed.quads, i, t);
+						}
+						for (int j=0;j<8;j++) {
+							if (t[j] < best[j] && t[j] > near) {
+								best[j] = t[j];
+								result[r + j] = i;
+							}
+						}
+					}
+				}
+			});
+			int mismatches = 0;
+			for (int r=0;r<numRays;r++) {
+				mismatches += result[r] != reference[r];
+			}
+			report(kind + " 8x1 " + k->name, numRays, seconds, baseline, mismatches);
+		}
+	}
+
+	return 0;
+}
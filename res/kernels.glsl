@@ -0,0 +1,96 @@
+// intersection kernels shared by shader.frag and the cpu tracer (included from intersect.hpp).
+// written in the common subset of glsl and c++ with glm: no swizzles, f suffixed literals,
+// arrays only as const parameters. expects Ray to be declared before it is included.
+
+#ifndef KERNEL
+#define KERNEL
+#endif
+
+KERNEL bool intersectAABB(Ray ray, const vec4 bounds[2]) {
+	float tx0 = (bounds[0].x - ray.origin.x)*ray.inverseDirection.x;
+	float tx1 = (bounds[1].x - ray.origin.x)*ray.inverseDirection.x;
+	float tmin = min(tx0, tx1);
+	float tmax = max(tx0, tx1);
+
+	float ty0 = (bounds[0].y - ray.origin.y)*ray.inverseDirection.y;
+	float ty1 = (bounds[1].y - ray.origin.y)*ray.inverseDirection.y;
+	tmin = max(tmin, min(ty0, ty1));
+	tmax = min(tmax, max(ty0, ty1));
+
+	float tz0 = (bounds[0].z - ray.origin.z)*ray.inverseDirection.z;
+	float tz1 = (bounds[1].z - ray.origin.z)*ray.inverseDirection.z;
+	tmin = max(tmin, min(tz0, tz1));
+	tmax = min(tmax, max(tz0, tz1));
+
+	return tmax >= tmin;
+}
+
+// entry and exit distance of the ray through a box, it overlaps when entry <= exit
+KERNEL vec2 intersectBounds(Ray ray, vec3 bmin, vec3 bmax) {
+	vec3 t0 = (bmin - ray.origin)*ray.inverseDirection;
+	vec3 t1 = (bmax - ray.origin)*ray.inverseDirection;
+	vec3 tmin = min(t0, t1);
+	vec3 tmax = max(t0, t1);
+	return vec2(max(max(tmin.x, tmin.y), tmin.z), min(min(tmax.x, tmax.y), tmax.z));
+}
+
+KERNEL float intersectPlane(Ray ray, vec4 normal) {
+	float a = dot(ray.direction, vec3(normal));
+	if (abs(a) < 0.001f) {
+		return -1.0f;
+	}
+	vec3 n = vec3(normal);
+	vec3 p0 = vec3(normal) * normal.w;
+	vec3 l = ray.direction;
+	vec3 l0 = ray.origin;
+	return dot((p0-l0), n) / dot(l, n);
+}
+
+KERNEL float intersectSphere(Ray ray, vec4 position) {
+	float a = dot(ray.direction, ray.direction);
+	vec3 offset = ray.origin - vec3(position);
+	float b = 2.0f * dot(ray.direction, offset);
+	float c = dot(offset, offset) - (position.w*position.w);
+	if (b*b - 4.0f*a*c < 0.0f) {
+		return -1.0f;
+	}
+	return (-b - sqrt((b*b) - 4.0f*a*c))/(2.0f*a);
+}
+
+KERNEL float intersectQuad(Ray ray, vec4 position, vec4 edge1, vec4 edge2, vec4 normal) {
+	float t = intersectPlane(ray, normal);
+	vec3 pos = ray.origin + ray.direction * t;
+	vec3 offset = pos - vec3(position);
+	vec3 e1 = vec3(edge1);
+	vec3 e2 = vec3(edge2);
+	vec3 n = vec3(normal);
+
+	float v1 = dot(cross(e1, offset), n);
+	float v2 = dot(cross(offset, e2), n);
+	float v3 = dot(cross(e1, e2 - offset), n);
+	float v4 = dot(cross(e1 - offset, e2), n);
+
+	if (v1 > 0.0f && v2 > 0.0f && v3 > 0.0f && v4 > 0.0f) {
+		return t;
+	}
+	return -1.0f;
+}
+
+// faces of a cube or volume spanned by three edges. faces 0-2 touch the corner at position,
+// faces 3-5 are the same faces shifted to the opposite corner
+KERNEL float intersectBoxFace(Ray ray, vec4 position, const vec4 edges[3], const vec4 normals[3], int face) {
+	int j = face % 3;
+	if (face < 3) {
+		return intersectQuad(ray, position, edges[j], edges[(j+1)%3], normals[j]);
+	}
+	vec4 normal = vec4(vec3(normals[j]), normals[j].w + dot(vec3(normals[j]), vec3(edges[(j+2)%3])));
+	return intersectQuad(ray, position + edges[(j+2)%3], edges[j], edges[(j+1)%3], normal);
+}
+
+// outward normal of a box face
+KERNEL vec3 boxFaceNormal(const vec4 normals[3], int face) {
+	if (face < 3) {
+		return -vec3(normals[face]);
+	}
+	return vec3(normals[face - 3]);
+}
@@ -0,0 +1,31 @@
+// scene object layouts shared by shader.frag and animate.comp. planes, spheres, quads and cubes are
+// uploaded as the shapes the intersection loops read, see the structs at the end of
+// src/objects.hpp. planes are their normal and spheres their position, both a plain vec4
+
+struct QuadShape {
+	vec4 position;
+	vec4 edges[2];
+	vec4 normal;
+};
+
+struct CubeShape {
+	vec4 position;
+	vec4 edges[3];
+	vec4 normals[3];
+};
+
+struct Volume {
+	vec4 position;
+	vec4 edges[3];
+	vec4 color;
+	vec4 material;
+	vec4 normals[3];
+	vec4 bounds[2];
+};
+
+struct Light {
+	vec4 position;
+	vec4 color;
+	vec4 material;
+	vec4 attenuation;
+};
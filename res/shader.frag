@@ -1,49 +1,30 @@
 #version 460 core
 
-struct Plane {
-	vec4 normal;
-	vec4 color;
-	vec4 material;
-};
+#include "objects.glsl"
 
-struct Sphere {
-	vec4 position;
-	vec4 color;
-	vec4 material;
+struct Instance {
+	mat4 transform;
+	mat4 inverse;
 	vec4 bounds[2];
-};
-
-struct Quad {
-	vec4 position;
-	vec4 edges[2];
+	vec4 localBounds[2];
 	vec4 color;
-	vec4 material;
-	vec4 normal;
-	vec4 bounds[2];
+	int prefab;
+	int root;
 };
 
-struct Cube {
-	vec4 position;
-	vec4 edges[3];
-	vec4 color;
-	vec4 material;
-	vec4 normals[3];
-	vec4 bounds[2];
-};
-
-struct Volume {
-	vec4 position;
-	vec4 edges[3];
-	vec4 color;
-	vec4 material;
-	vec4 normals[3];
-	vec4 bounds[2];
+struct Node {
+	vec3 min;
+	int start;
+	vec3 max;
+	int count;
 };
 
-struct Light {
-	vec4 position;
-	vec4 color;
-	vec4 material;
+struct WideNode {
+	vec3 origin;
+	uint exponents;
+	uint lo[3];
+	uint hi[3];
+	int children[4];
 };
 
 struct Ray {
@@ -52,6 +33,8 @@ struct Ray {
 	vec3 inverseDirection;
 };
 
+// the searches only keep distance, object, face and instance. resolve() fills in the rest once
+// for the nearest hit
 struct RayHit {
 	vec3 position;
 	float distance;
@@ -60,12 +43,23 @@ struct RayHit {
 	vec4 material;
 	vec4 tint;
 	bool final;
+	int object; // type << TYPE_SHIFT | index, into the prefab arrays inside an instance
+	int face; // of a cube
+	int instance; // -1 outside the instances
 };
 
 float far = 10000.0;
 float near = 0.001;
 const float PI = 3.1415926;
-const int MAX_OBJECTS = 60;
+const int MAX_DEPTH = 64;
+const int WIDE_STACK = 3*MAX_DEPTH + 1;
+const int SPHERE = 0;
+const int QUAD = 1;
+const int CUBE = 2;
+const int PLANE = 4;
+const int LIGHT = 5;
+const int TYPE_SHIFT = 28;
+const int INDEX_MASK = (1 << TYPE_SHIFT) - 1;
 
 layout (location = 0) in vec2 uvPos;
 
@@ -81,189 +75,473 @@ layout (location = 6) uniform bool reflections;
 layout (location = 7) uniform bool lighting;
 layout (location = 8) uniform bool shadows;
 layout (location = 9) uniform vec4 skyColor;
-layout (location = 10) uniform int numPlanes;
-layout (location = 11) uniform int numSpheres;
-layout (location = 12) uniform int numQuads;
-layout (location = 13) uniform int numCubes;
-layout (location = 14) uniform int numVolumes;
-layout (location = 15) uniform int numLights;
-
-layout (binding = 0, std140) uniform Objects {
-	Plane planes[MAX_OBJECTS];
-	Sphere spheres[MAX_OBJECTS];
-	Quad quads[MAX_OBJECTS];
-	Cube cubes[MAX_OBJECTS];
-	Volume volumes[MAX_OBJECTS];
-	Light lights[MAX_OBJECTS];
+layout (location = 16) uniform int numNodes;
+layout (location = 17) uniform int accelerator; // 0 linear, 1 bvh, 2 sphere grid
+layout (location = 18) uniform int numInstances;
+layout (location = 19) uniform int prefabNodes; // first prefab node, the instance bvh starts at numNodes
+layout (location = 20) uniform int numWideNodes; // scene bvh collapsed to 4-wide nodes, 0 when binary
+layout (location = 21) uniform vec4 gridOrigin; // x, y, z, cell size
+layout (location = 22) uniform ivec4 gridSize; // cells per axis, buckets
+layout (location = 23) uniform ivec2 visibleList; // first reference and count of the primitives in the camera frustum
+layout (location = 24) uniform vec4 lightGridOrigin; // x, y, z, cell size
+layout (location = 25) uniform ivec4 lightGridSize; // cells per axis, buckets
+layout (location = 26) uniform ivec2 lightLists; // first unbounded light in the grid buffer, their count
+layout (location = 27) uniform int surfaceStarts[6]; // spheres, quads, cubes, prefab spheres, prefab quads, prefab cubes
+layout (location = 33) uniform ivec2 paletteStarts; // first color and first material in surfaces
+
+// one buffer per primitive type, each bound to its live range so length() is the count. planes
+// hold their normal and spheres their position, the colors and materials are in the surfaces
+layout (binding = 9, std430) readonly buffer Planes {
+	vec4 planes[];
+};
+
+layout (binding = 10, std430) readonly buffer Spheres {
+	vec4 spheres[];
 };
 
-bool intersectAABB(Ray ray, vec4 bounds[2]) {
-	float tx0 = (bounds[0].x - ray.origin.x)*ray.inverseDirection.x;
-	float tx1 = (bounds[1].x - ray.origin.x)*ray.inverseDirection.x;
-	float tmin = min(tx0, tx1);
-	float tmax = max(tx0, tx1);
+layout (binding = 11, std430) readonly buffer Quads {
+	QuadShape quads[];
+};
 
-	float ty0 = (bounds[0].y - ray.origin.y)*ray.inverseDirection.y;
-	float ty1 = (bounds[1].y - ray.origin.y)*ray.inverseDirection.y;
-	tmin = max(tmin, min(ty0, ty1));
-	tmax = min(tmax, max(ty0, ty1));
-	
-	float tz0 = (bounds[0].z - ray.origin.z)*ray.inverseDirection.z;
-	float tz1 = (bounds[1].z - ray.origin.z)*ray.inverseDirection.z;
-	tmin = max(tmin, min(tz0, tz1));
-	tmax = min(tmax, max(tz0, tz1));
+layout (binding = 12, std430) readonly buffer Cubes {
+	CubeShape cubes[];
+};
 
-	return tmax >= tmin;
-}
+layout (binding = 13, std430) readonly buffer Volumes {
+	Volume volumes[];
+};
+
+layout (binding = 14, std430) readonly buffer Lights {
+	Light lights[];
+};
+
+layout (binding = 1, std430) readonly buffer Nodes {
+	Node nodes[];
+};
+
+layout (binding = 2, std430) readonly buffer References {
+	int references[];
+};
+
+layout (binding = 3, std430) readonly buffer Instances {
+	Instance instances[];
+};
+
+layout (binding = 4, std430) readonly buffer PrefabSpheres {
+	vec4 prefabSpheres[];
+};
+
+layout (binding = 5, std430) readonly buffer PrefabQuads {
+	QuadShape prefabQuads[];
+};
+
+layout (binding = 6, std430) readonly buffer PrefabCubes {
+	CubeShape prefabCubes[];
+};
+
+// per object its color and material index into the palette, the color in the low 16 bits, four to
+// an element. planes first, then the other arrays from surfaceStarts. the palette follows as the
+// bits of its colors, then its materials, from paletteStarts. one block rather than two, the
+// fragment stage has no storage blocks to spare
+layout (binding = 0, std430) readonly buffer Surfaces {
+	uvec4 surfaces[];
+};
+
+layout (binding = 7, std430) readonly buffer WideNodes {
+	WideNode wideNodes[];
+};
+
+// bucket starts (buckets + 1), then the sphere indices grouped by bucket. after those the lights
+// without a radius, then the light grid's bucket starts and light indices
+layout (binding = 8, std430) readonly buffer Grid {
+	int grid[];
+};
+
+#include "kernels.glsl"
 
-float intersectPlane(Ray ray, vec4 normal) {
-	float a = dot(ray.direction, normal.xyz);
-	if (abs(a) < 0.001) {
-		return -1.0;
+void traceSphere(Ray ray, vec4 sphere, int index, inout RayHit hit) {
+	float t = intersectSphere(ray, sphere);
+	if (t < hit.distance && t > near) {
+		hit.distance = t;
+		hit.object = SPHERE << TYPE_SHIFT | index;
 	}
-	vec3 n = normal.xyz;
-	vec3 p0 = normal.xyz * normal.w;
-	vec3 l = ray.direction;
-	vec3 l0 = ray.origin;
-	return dot((p0-l0), n) / dot(l, n);
 }
 
-float intersectSphere(Ray ray, vec4 position) {
-	float a = dot(ray.direction, ray.direction);
-	vec3 offset = ray.origin - position.xyz;
-	float b = 2.0 * dot(ray.direction, offset);
-	float c = dot(offset, offset) - (position.w*position.w);
-	if (b*b - 4.0*a*c < 0.0) {
-		return -1.0;
+// the bounds are the corners generate() puts them at
+void traceQuad(Ray ray, QuadShape quad, int index, inout RayHit hit) {
+	vec4 bounds[2] = vec4[2](quad.position, quad.position + quad.edges[0] + quad.edges[1]);
+	if (!intersectAABB(ray, bounds)) {
+		return;
+	}
+	float t = intersectQuad(ray, quad.position, quad.edges[0], quad.edges[1], quad.normal);
+	if (t < hit.distance && t > near) {
+		hit.distance = t;
+		hit.object = QUAD << TYPE_SHIFT | index;
 	}
-	return (-b - sqrt((b*b) - 4.0*a*c))/(2.0*a);
 }
 
-float intersectQuad(Ray ray, vec4 position, vec4 edges[2], vec4 normal) {
-	float t = intersectPlane(ray, normal);
-	vec3 pos = ray.origin + ray.direction * t;
-	vec3 offset = pos - position.xyz; 
-	vec3 e1 = edges[0].xyz;
-	vec3 e2 = edges[1].xyz;
-	vec3 n = normal.xyz;
+void traceCube(Ray ray, CubeShape cube, int index, inout RayHit hit) {
+	vec4 bounds[2] = vec4[2](cube.position, cube.position + cube.edges[0] + cube.edges[1] + cube.edges[2]);
+	if (!intersectAABB(ray, bounds)) {
+		return;
+	}
+	for (int j=0;j<6;j++) {
+		float t = intersectBoxFace(ray, cube.position, cube.edges, cube.normals, j);
+		if (t < hit.distance && t > near) {
+			if (dot(ray.direction, boxFaceNormal(cube.normals, j)) > 0.0) {
+				continue;
+			}
+			hit.distance = t;
+			hit.object = CUBE << TYPE_SHIFT | index;
+			hit.face = j;
+		}
+	}
+}
 
-	float v1 = dot(cross(e1, offset), n);
-	float v2 = dot(cross(offset, e2), n);
-	float v3 = dot(cross(e1, e2 - offset), n);
-	float v4 = dot(cross(e1 - offset, e2), n);
+bool overlapNode(Ray ray, int node, float distance, out float entry) {
+	vec2 range = intersectBounds(ray, nodes[node].min, nodes[node].max);
+	entry = range.x;
+	return range.x <= range.y && range.y > near && range.x < distance;
+}
 
-	if (v1 > 0.0 && v2 > 0.0 && v3 > 0.0 && v4 > 0.0) {
-		return t;
+// the scene bvh from node 0, or a prefab bvh whose references index the prefab primitives.
+// with any set it returns after the first leaf that shortened hit.distance
+void traceBVH(Ray ray, int root, bool prefab, bool any, inout RayHit hit) {
+	float limit = hit.distance;
+	float entry;
+	if (root < 0 || !overlapNode(ray, root, hit.distance, entry)) {
+		return;
+	}
+	int stack[MAX_DEPTH];
+	int top = 0;
+	int node = root;
+	while (true) {
+		if (nodes[node].count > 0) {
+			for (int k=nodes[node].start;k<nodes[node].start+nodes[node].count;k++) {
+				int type = references[k] >> TYPE_SHIFT;
+				int index = references[k] & INDEX_MASK;
+				if (type == SPHERE) {
+					traceSphere(ray, prefab ? prefabSpheres[index] : spheres[index], index, hit);
+				} else if (type == QUAD) {
+					traceQuad(ray, prefab ? prefabQuads[index] : quads[index], index, hit);
+				} else {
+					traceCube(ray, prefab ? prefabCubes[index] : cubes[index], index, hit);
+				}
+			}
+			if (any && hit.distance < limit) {
+				return;
+			}
+		} else {
+			int left = nodes[node].start;
+			float leftEntry, rightEntry;
+			bool hitLeft = overlapNode(ray, left, hit.distance, leftEntry);
+			bool hitRight = overlapNode(ray, left + 1, hit.distance, rightEntry);
+			if (hitLeft && hitRight) {
+				// nearer child first, the other one waits on the stack
+				node = leftEntry <= rightEntry ? left : left + 1;
+				stack[top++] = leftEntry <= rightEntry ? left + 1 : left;
+				continue;
+			}
+			if (hitLeft || hitRight) {
+				node = hitLeft ? left : left + 1;
+				continue;
+			}
+		}
+		if (top == 0) {
+			break;
+		}
+		node = stack[--top];
 	}
-	return -1.0;
 }
 
-RayHit trace(Ray ray) {
-	RayHit hit;
-	hit.distance = far + 1.0;
-	hit.tint = vec4(0.0, 0.0, 0.0, 0.0);
-	
-	for (int i=0;i<numPlanes;i++) {
-		float t = intersectPlane(ray, planes[i].normal);
-		if (t < hit.distance && t > near) {
-			hit.distance = t;
-			hit.position = ray.origin + ray.direction * hit.distance;
-			hit.normal = planes[i].normal.xyz;
-			if (dot(ray.direction, hit.normal) > 0.0) {
-				hit.normal = -hit.normal;
+// the scene bvh in 4-wide nodes with quantized child boxes. the stack holds wide nodes and leaves,
+// leaves with the top bit set and their reference count above the first reference
+void traceWide(Ray ray, bool any, inout RayHit hit) {
+	float limit = hit.distance;
+	int stack[WIDE_STACK];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int code = stack[--top];
+		if (code < 0) {
+			for (int k=code&0x7fffff;k<(code&0x7fffff)+(code>>23&0xff);k++) {
+				int type = references[k] >> TYPE_SHIFT;
+				int index = references[k] & INDEX_MASK;
+				if (type == SPHERE) {
+					traceSphere(ray, spheres[index], index, hit);
+				} else if (type == QUAD) {
+					traceQuad(ray, quads[index], index, hit);
+				} else {
+					traceCube(ray, cubes[index], index, hit);
+				}
+			}
+			if (any && hit.distance < limit) {
+				return;
+			}
+			continue;
+		}
+		uint exponents = wideNodes[code].exponents;
+		vec3 scale = vec3(uintBitsToFloat((exponents & 0xffu) << 23), uintBitsToFloat((exponents >> 8 & 0xffu) << 23), uintBitsToFloat((exponents >> 16 & 0xffu) << 23));
+		float entries[4];
+		int codes[4];
+		int count = 0;
+		for (int c=0;c<4;c++) {
+			if (wideNodes[code].children[c] == -1) {
+				continue;
+			}
+			vec3 lo = wideNodes[code].origin + vec3(wideNodes[code].lo[0] >> 8*c & 0xffu, wideNodes[code].lo[1] >> 8*c & 0xffu, wideNodes[code].lo[2] >> 8*c & 0xffu) * scale;
+			vec3 hi = wideNodes[code].origin + vec3(wideNodes[code].hi[0] >> 8*c & 0xffu, wideNodes[code].hi[1] >> 8*c & 0xffu, wideNodes[code].hi[2] >> 8*c & 0xffu) * scale;
+			vec2 range = intersectBounds(ray, lo, hi);
+			if (range.x > range.y || range.y <= near || range.x >= hit.distance) {
+				continue;
 			}
-			hit.color = planes[i].color;
-			hit.material = planes[i].material;
-			hit.final = false;
+			// farthest first, so the nearest child is popped next
+			int j = count++;
+			while (j > 0 && entries[j-1] <= range.x) {
+				entries[j] = entries[j-1];
+				codes[j] = codes[j-1];
+				j--;
+			}
+			entries[j] = range.x;
+			codes[j] = wideNodes[code].children[c];
+		}
+		for (int j=0;j<count;j++) {
+			stack[top++] = codes[j];
 		}
 	}
+}
 
-	for (int i=0;i<numSpheres;i++) {
-		float t = intersectSphere(ray, spheres[i].position);
-		if (t < hit.distance && t > near) {
-			hit.distance = t;
-			hit.position = ray.origin + ray.direction * hit.distance;
-			hit.normal = normalize(hit.position - spheres[i].position.xyz);
-			hit.color = spheres[i].color;
-			hit.material = spheres[i].material;
-			hit.final = false;
+int gridBucket(ivec3 cell) {
+	return int((uint(cell.x) * 73856093u ^ uint(cell.y) * 19349663u ^ uint(cell.z) * 83492791u) & uint(gridSize.w - 1));
+}
+
+// 3d-dda through the grid cells along the ray. a sphere listed in a cell may be hit beyond it,
+// so the walk stops once the hit is nearer than the cell's exit
+void traceGrid(Ray ray, bool any, inout RayHit hit) {
+	float limit = hit.distance;
+	vec3 gridMin = gridOrigin.xyz;
+	float cellSize = gridOrigin.w;
+	vec2 range = intersectBounds(ray, gridMin, gridMin + vec3(gridSize.xyz) * cellSize);
+	if (gridSize.w == 0 || range.x > range.y || range.y <= near || range.x >= hit.distance) {
+		return;
+	}
+	vec3 entry = ray.origin + ray.direction * max(range.x, 0.0);
+	ivec3 cell = clamp(ivec3(floor((entry - gridMin) / cellSize)), ivec3(0), gridSize.xyz - 1);
+	ivec3 step;
+	vec3 next;
+	vec3 delta;
+	for (int axis=0;axis<3;axis++) {
+		step[axis] = ray.direction[axis] < 0.0 ? -1 : 1;
+		float boundary = gridMin[axis] + float(cell[axis] + (step[axis] > 0 ? 1 : 0)) * cellSize;
+		next[axis] = ray.direction[axis] == 0.0 ? 2.0*far : (boundary - ray.origin[axis]) * ray.inverseDirection[axis];
+		delta[axis] = ray.direction[axis] == 0.0 ? 2.0*far : cellSize * abs(ray.inverseDirection[axis]);
+	}
+	while (true) {
+		int b = gridBucket(cell);
+		for (int k=grid[b];k<grid[b + 1];k++) {
+			int index = grid[gridSize.w + 1 + k];
+			traceSphere(ray, spheres[index], index, hit);
+		}
+		int axis = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+		if (hit.distance <= next[axis] || next[axis] > range.y || (any && hit.distance < limit)) {
+			break;
+		}
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= gridSize[axis]) {
+			break;
 		}
+		next[axis] += delta[axis];
 	}
+}
 
-	for (int i=0;i<numQuads;i++) {
-		if (!intersectAABB(ray, quads[i].bounds)) {
-			continue;
+// the prefab bvh with the ray in the instance's local space. the direction is not renormalized,
+// so distances along it stay comparable with the world space hit
+void traceInstance(Ray ray, int i, bool any, inout RayHit hit) {
+	mat4 inverse = instances[i].inverse;
+	vec3 direction = vec3(inverse * vec4(ray.direction, 0.0));
+	Ray local = Ray(vec3(inverse * vec4(ray.origin, 1.0)), direction, vec3(1.0/direction.x, 1.0/direction.y, 1.0/direction.z));
+	RayHit localHit = hit;
+	traceBVH(local, instances[i].root < 0 ? -1 : prefabNodes + instances[i].root, true, any, localHit);
+	if (localHit.distance < hit.distance) {
+		hit = localHit;
+		hit.instance = i;
+	}
+}
+
+// the instance bvh follows the scene bvh in the node array
+void traceInstances(Ray ray, bool any, inout RayHit hit) {
+	float limit = hit.distance;
+	if (accelerator != 1) {
+		for (int i=0;i<numInstances;i++) {
+			if (intersectAABB(ray, instances[i].bounds)) {
+				traceInstance(ray, i, any, hit);
+				if (any && hit.distance < limit) {
+					return;
+				}
+			}
+		}
+		return;
+	}
+	float entry;
+	if (!overlapNode(ray, numNodes, hit.distance, entry)) {
+		return;
+	}
+	int stack[MAX_DEPTH];
+	int top = 0;
+	int node = numNodes;
+	while (true) {
+		if (nodes[node].count > 0) {
+			for (int k=nodes[node].start;k<nodes[node].start+nodes[node].count;k++) {
+				traceInstance(ray, references[k] & INDEX_MASK, any, hit);
+			}
+			if (any && hit.distance < limit) {
+				return;
+			}
+		} else {
+			int left = nodes[node].start;
+			float leftEntry, rightEntry;
+			bool hitLeft = overlapNode(ray, left, hit.distance, leftEntry);
+			bool hitRight = overlapNode(ray, left + 1, hit.distance, rightEntry);
+			if (hitLeft && hitRight) {
+				node = leftEntry <= rightEntry ? left : left + 1;
+				stack[top++] = leftEntry <= rightEntry ? left + 1 : left;
+				continue;
+			}
+			if (hitLeft || hitRight) {
+				node = hitLeft ? left : left + 1;
+				continue;
+			}
+		}
+		if (top == 0) {
+			break;
 		}
-		float t = intersectQuad(ray, quads[i].position, quads[i].edges, quads[i].normal);
+		node = stack[--top];
+	}
+}
+
+// position, normal and surface of the nearest hit, computed as the searches used to for every
+// closer hit they found. inside an instance the normal comes from the ray in its local space
+void resolve(Ray ray, inout RayHit hit) {
+	int type = hit.object >> TYPE_SHIFT;
+	int index = hit.object & INDEX_MASK;
+	if (type == LIGHT) {
+		vec3 pos = lights[index].position.xyz - ray.origin;
+		hit.position = ray.origin + ray.direction * length(pos);
+		hit.normal = -normalize(pos);
+		hit.color = vec4(lights[index].color.rgb, 1.0f);
+		hit.material = vec4(0.0, 0.0, 0.0, 0.0);
+		hit.final = true;
+		return;
+	}
+	bool prefab = hit.instance >= 0;
+	Ray local = ray;
+	mat4 inverse;
+	if (prefab) {
+		inverse = instances[hit.instance].inverse;
+		vec3 direction = vec3(inverse * vec4(ray.direction, 0.0));
+		local = Ray(vec3(inverse * vec4(ray.origin, 1.0)), direction, vec3(1.0/direction.x, 1.0/direction.y, 1.0/direction.z));
+	}
+	hit.position = local.origin + local.direction * hit.distance;
+	if (type == PLANE) {
+		hit.normal = planes[index].xyz;
+	} else if (type == SPHERE) {
+		hit.normal = normalize(hit.position - (prefab ? prefabSpheres[index] : spheres[index]).xyz);
+	} else if (type == QUAD) {
+		hit.normal = (prefab ? prefabQuads[index] : quads[index]).normal.xyz;
+	} else {
+		hit.normal = boxFaceNormal((prefab ? prefabCubes[index] : cubes[index]).normals, hit.face);
+	}
+	if ((type == PLANE || type == QUAD) && dot(local.direction, hit.normal) > 0.0) {
+		hit.normal = -hit.normal;
+	}
+	int slot = type == PLANE ? index : surfaceStarts[prefab ? type + 3 : type] + index;
+	uint surface = surfaces[slot >> 2][slot & 3];
+	hit.color = uintBitsToFloat(surfaces[paletteStarts.x + int(surface & 0xffffu)]);
+	hit.material = uintBitsToFloat(surfaces[paletteStarts.y + int(surface >> 16)]);
+	hit.final = false;
+	if (prefab) {
+		hit.position = ray.origin + ray.direction * hit.distance;
+		hit.normal = normalize(mat3(transpose(inverse)) * hit.normal);
+		if (instances[hit.instance].color.a >= 0.0) {
+			hit.color = instances[hit.instance].color;
+		}
+	}
+}
+
+// primary rays outside the bvh only test the primitives culled to the camera frustum on the cpu
+RayHit trace(Ray ray, bool primary) {
+	RayHit hit;
+	hit.distance = far + 1.0;
+	hit.tint = vec4(0.0, 0.0, 0.0, 0.0);
+	hit.object = -1;
+	hit.instance = -1;
+	
+	for (int i=0;i<planes.length();i++) {
+		float t = intersectPlane(ray, planes[i]);
 		if (t < hit.distance && t > near) {
 			hit.distance = t;
-			hit.position = ray.origin + ray.direction * hit.distance;
-			hit.normal = quads[i].normal.xyz;
-			if (dot(ray.direction, hit.normal) > 0.0) {
-				hit.normal = -hit.normal;
-			}
-			hit.color = quads[i].color;
-			hit.material = quads[i].material;
-			hit.final = false;
+			hit.object = PLANE << TYPE_SHIFT | i;
 		}
 	}
 
-	for (int i=0;i<numCubes;i++) {
-		if (!intersectAABB(ray, cubes[i].bounds)) {
-			continue;
+	if (accelerator == 1) {
+		if (numWideNodes > 0) {
+			traceWide(ray, false, hit);
+		} else {
+			traceBVH(ray, numNodes == 0 ? -1 : 0, false, false, hit);
+		}
+	} else if (primary) {
+		if (accelerator == 2) {
+			traceGrid(ray, false, hit);
 		}
-		for (int j=0;j<3;j++) {
-			float t = intersectQuad(ray, cubes[i].position, vec4[](cubes[i].edges[j], cubes[i].edges[(j+1)%3]), cubes[i].normals[j]);
-			if (t < hit.distance && t > near) {
-				if (dot(ray.direction, -cubes[i].normals[j].xyz) > 0.0) {
-					continue;
+		for (int k=visibleList.x;k<visibleList.x+visibleList.y;k++) {
+			int type = references[k] >> TYPE_SHIFT;
+			int index = references[k] & INDEX_MASK;
+			if (type == SPHERE) {
+				if (accelerator != 2) {
+					traceSphere(ray, spheres[index], index, hit);
 				}
-				hit.distance = t;
-				hit.position = ray.origin + ray.direction * hit.distance;
-				hit.normal = -cubes[i].normals[j].xyz;
-				hit.color = cubes[i].color;
-				hit.material = cubes[i].material;
-				hit.final = false;
+			} else if (type == QUAD) {
+				traceQuad(ray, quads[index], index, hit);
+			} else {
+				traceCube(ray, cubes[index], index, hit);
 			}
 		}
-		for (int j=0;j<3;j++) {
-			float t = intersectQuad(ray, cubes[i].position + cubes[i].edges[(j+2)%3], vec4[](cubes[i].edges[j], cubes[i].edges[(j+1)%3]), vec4(cubes[i].normals[j].xyz, cubes[i].normals[j].w + dot(cubes[i].normals[j].xyz, cubes[i].edges[(j+2)%3].xyz)));
-			if (t < hit.distance && t > near) {
-				if (dot(ray.direction, cubes[i].normals[j].xyz) > 0.0) {
-					continue;
-				}
-				hit.distance = t;
-				hit.position = ray.origin + ray.direction * hit.distance;
-				hit.normal = cubes[i].normals[j].xyz;
-				hit.color = cubes[i].color;
-				hit.material = cubes[i].material;
-				hit.final = false;
+	} else {
+		if (accelerator == 2) {
+			traceGrid(ray, false, hit);
+		} else {
+			for (int i=0;i<spheres.length();i++) {
+				traceSphere(ray, spheres[i], i, hit);
 			}
 		}
+		for (int i=0;i<quads.length();i++) {
+			traceQuad(ray, quads[i], i, hit);
+		}
+		for (int i=0;i<cubes.length();i++) {
+			traceCube(ray, cubes[i], i, hit);
+		}
+	}
+	if (numInstances > 0) {
+		traceInstances(ray, false, hit);
 	}
 
-	for (int i=0;i<numLights;i++) {
+	for (int i=0;i<lights.length();i++) {
 		vec3 pos = lights[i].position.xyz - ray.origin;
 		if (hit.distance > length(pos) && dot(ray.direction, normalize(pos)) > 0.9999) {
 			hit.distance = length(pos);
-			hit.position = ray.origin + ray.direction * length(pos);
-			hit.normal = -normalize(pos);
-			hit.color = vec4(lights[i].color.rgb, 1.0f);
-			hit.material = vec4(0.0, 0.0, 0.0, 0.0);
-			hit.final = true;
+			hit.object = LIGHT << TYPE_SHIFT | i;
+			hit.instance = -1;
 		}
 	}
 
-	for (int i=0;i<numVolumes;i++) {
+	for (int i=0;i<volumes.length();i++) {
 		if (!intersectAABB(ray, volumes[i].bounds)) {
 			continue;
 		}
 		float t[6];
-		for (int j=0;j<3;j++) {
-			t[j] = intersectQuad(ray, volumes[i].position, vec4[](volumes[i].edges[j], volumes[i].edges[(j+1)%3]), volumes[i].normals[j]);
-		}
-		for (int j=0;j<3;j++) {
-			t[j+3] = intersectQuad(ray, volumes[i].position + volumes[i].edges[(j+2)%3], vec4[](volumes[i].edges[j], volumes[i].edges[(j+1)%3]), vec4(volumes[i].normals[j].xyz, volumes[i].normals[j].w + dot(volumes[i].normals[j].xyz, volumes[i].edges[(j+2)%3].xyz)));
+		for (int j=0;j<6;j++) {
+			t[j] = intersectBoxFace(ray, volumes[i].position, volumes[i].edges, volumes[i].normals, j);
 		}
 		float s[2];
 		int k = 0;
@@ -291,11 +569,107 @@ RayHit trace(Ray ray) {
 		hit.color = vec4(mix(skyColor.rgb*skyColor.a, skyColor.rgb, skyAngle), 1.0);
 		hit.material = vec4(0.0, 0.0, 0.0, 0.0);
 		hit.final = true;
+	} else {
+		resolve(ray, hit);
 	}
 
 	return hit;
 }
 
+// any occluder nearer than distance, for shadow rays. lights and volumes don't occlude, and the
+// traversals return at the first hit instead of searching for the closest
+bool traceShadow(Ray ray, float distance) {
+	// trace() ends at the sky past far, which occludes lights beyond it
+	if (distance > far + 1.0) {
+		return true;
+	}
+	for (int i=0;i<planes.length();i++) {
+		float t = intersectPlane(ray, planes[i]);
+		if (t < distance && t > near) {
+			return true;
+		}
+	}
+
+	RayHit hit;
+	hit.distance = distance;
+	if (accelerator == 1) {
+		if (numWideNodes > 0) {
+			traceWide(ray, true, hit);
+		} else {
+			traceBVH(ray, numNodes == 0 ? -1 : 0, false, true, hit);
+		}
+	} else {
+		if (accelerator == 2) {
+			traceGrid(ray, true, hit);
+		} else {
+			for (int i=0;i<spheres.length() && hit.distance >= distance;i++) {
+				traceSphere(ray, spheres[i], i, hit);
+			}
+		}
+		for (int i=0;i<quads.length() && hit.distance >= distance;i++) {
+			traceQuad(ray, quads[i], i, hit);
+		}
+		for (int i=0;i<cubes.length() && hit.distance >= distance;i++) {
+			traceCube(ray, cubes[i], i, hit);
+		}
+	}
+	if (numInstances > 0 && hit.distance >= distance) {
+		traceInstances(ray, true, hit);
+	}
+	return hit.distance < distance;
+}
+
+// the falloff windowed to reach 0 at the radius, 1 for lights without one
+float falloff(Light light, float distance) {
+	if (light.attenuation.x <= 0.0) {
+		return 1.0;
+	}
+	float x = distance / light.attenuation.x;
+	float window = clamp(1.0 - x*x, 0.0, 1.0);
+	return window*window / (light.attenuation.y + light.attenuation.z*distance + light.attenuation.w*distance*distance);
+}
+
+// bucket of the light grid cell holding position, -1 outside the grid
+int lightBucket(vec3 position) {
+	vec3 gridMin = lightGridOrigin.xyz;
+	if (lightGridSize.w == 0 || any(lessThan(position, gridMin)) || any(greaterThan(position, gridMin + vec3(lightGridSize.xyz) * lightGridOrigin.w))) {
+		return -1;
+	}
+	ivec3 cell = clamp(ivec3(floor((position - gridMin) / lightGridOrigin.w)), ivec3(0), lightGridSize.xyz - 1);
+	return int((uint(cell.x) * 73856093u ^ uint(cell.y) * 19349663u ^ uint(cell.z) * 83492791u) & uint(lightGridSize.w - 1));
+}
+
+vec3 shadeLight(int j, RayHit hit, vec3 prevPos) {
+	float distance = length(lights[j].position.xyz - hit.position);
+	float attenuation = falloff(lights[j], distance);
+	if (attenuation <= 0.0) {
+		return vec3(0.0);
+	}
+	vec3 lightDir = normalize(lights[j].position.xyz - hit.position);
+	vec3 viewDir = normalize(prevPos - hit.position);
+	vec3 reflectDir = reflect(-lightDir, hit.normal);
+	vec3 halfwayDir = normalize(lightDir + viewDir);
+
+	float diffuseFactor = max(dot(hit.normal, lightDir), 0.0);
+	// float specularFactor = max(dot(viewDir, reflectDir), 0.0) * max(sign(diffuseFactor), 0.0);
+	float specularFactor = max(dot(hit.normal, halfwayDir), 0.0) * max(sign(diffuseFactor), 0.0);
+
+	if (shadows && diffuseFactor + specularFactor > 0.0) {
+		Ray shadowRay = Ray(hit.position, lightDir, vec3(1.0/lightDir.x, 1.0/lightDir.y, 1.0/lightDir.z));
+		if (traceShadow(shadowRay, distance)) {
+			diffuseFactor = 0.0;
+			specularFactor = 0.0;
+		}
+	}
+
+	vec3 ambient = lights[j].color.rgb * hit.material.x * lights[j].material.x;
+	vec3 diffuse = lights[j].color.rgb * diffuseFactor * hit.material.y * lights[j].material.y;
+	vec3 specular = lights[j].color.rgb * pow(specularFactor, hit.material.w * lights[j].material.w * 2.0) * hit.material.z * lights[j].material.z;
+	vec3 phong = (ambient + diffuse + specular) * hit.color.rgb;
+
+	return phong * attenuation;
+}
+
 vec4 render() {
 	vec2 uv = uvPos;
 	uv.y *= float(windowSize.y)/float(windowSize.x);
@@ -310,52 +684,37 @@ vec4 render() {
 
 	vec3 rayDir = normalize(cameraDir + rayOffset * fov / 180.0 * PI);
 	rays[0] = Ray(cameraPos, rayDir, vec3(1.0/rayDir.x, 1.0/rayDir.y, 1.0/rayDir.z));
-	hits[0] = trace(rays[0]);
+	hits[0] = trace(rays[0], true);
 
 	if (reflections && !hits[0].final) {
 		for (int i=1;i<bounces;i++) {
 			lastHit = i;
 			rayDir = reflect(rays[i-1].direction, hits[i-1].normal);
 			rays[i] = Ray(hits[i-1].position, rayDir, vec3(1.0/rayDir.x, 1.0/rayDir.y, 1.0/rayDir.z));
-			hits[i] = trace(rays[i]);
+			hits[i] = trace(rays[i], false);
 			if (hits[i].final) {
 				break;
 			}
 		}
 	}
 	
-	if (lighting && numLights > 0) {
+	if (lighting && lights.length() > 0) {
 		vec3 prevPos = cameraPos;
 		for (int i=0;i<=lastHit;i++) {
 			if (hits[i].final) {
 				continue;
 			}
+			// the lights without a radius, then the ones whose radius reaches into the hit's cell
 			vec3 sum = vec3(0.0, 0.0, 0.0);
-			for (int j=0;j<numLights;j++) {
-				vec3 lightDir = normalize(lights[j].position.xyz - hits[i].position);
-				vec3 viewDir = normalize(prevPos - hits[i].position);
-				vec3 reflectDir = reflect(-lightDir, hits[i].normal);
-				vec3 halfwayDir = normalize(lightDir + viewDir);
-
-				float diffuseFactor = max(dot(hits[i].normal, lightDir), 0.0);
-				// float specularFactor = max(dot(viewDir, reflectDir), 0.0) * max(sign(diffuseFactor), 0.0);
-				float specularFactor = max(dot(hits[i].normal, halfwayDir), 0.0) * max(sign(diffuseFactor), 0.0);
-
-				if (shadows && diffuseFactor + specularFactor > 0.0) {
-					Ray shadowRay = Ray(hits[i].position, lightDir, vec3(1.0/lightDir.x, 1.0/lightDir.y, 1.0/lightDir.z));
-					RayHit shadowHit = trace(shadowRay);
-					if (shadowHit.distance < length(lights[j].position.xyz - hits[i].position)) {
-						diffuseFactor = 0.0;
-						specularFactor = 0.0;
-					}
+			for (int k=lightLists.x;k<lightLists.x+lightLists.y;k++) {
+				sum += shadeLight(grid[k], hits[i], prevPos);
+			}
+			int b = lightBucket(hits[i].position);
+			if (b >= 0) {
+				int starts = lightLists.x + lightLists.y;
+				for (int k=grid[starts + b];k<grid[starts + b + 1];k++) {
+					sum += shadeLight(grid[starts + lightGridSize.w + 1 + k], hits[i], prevPos);
 				}
-
-				vec3 ambient = lights[j].color.rgb * hits[i].material.x * lights[j].material.x;
-				vec3 diffuse = lights[j].color.rgb * diffuseFactor * hits[i].material.y * lights[j].material.y;
-				vec3 specular = lights[j].color.rgb * pow(specularFactor, hits[i].material.w * lights[j].material.w * 2.0) * hits[i].material.z * lights[j].material.z;
-				vec3 phong = (ambient + diffuse + specular) * hits[i].color.rgb;
-
-				sum += phong;
 			}
 			hits[i].color = vec4(mix(hits[i].color.rgb, sum, hits[i].color.a), hits[i].color.a);
 			prevPos = hits[i].position;
@@ -3,6 +3,7 @@
 #include "camera.hpp"
 #include "scene.hpp"
 #include "renderer.hpp"
+#include "tracer.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtx/string_cast.hpp>
@@ -10,6 +11,11 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <iomanip>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
 
 App app;
 
@@ -38,8 +44,9 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			app.renderer.bounces = 1;
 		}
 	}
+	// 1-9 load their scene, 0 the tenth
 	if (key >= GLFW_KEY_0 && key <= GLFW_KEY_9 && action == GLFW_PRESS) {
-		app.scene.load(key - GLFW_KEY_0);
+		app.scene.load(key == GLFW_KEY_0 ? 10 : key - GLFW_KEY_0);
 		app.renderer.updateBuffers();
 	}
 	if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
@@ -54,6 +61,14 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	if (key == GLFW_KEY_V && action == GLFW_PRESS) {
 		app.renderer.shadows = !app.renderer.shadows;
 	}
+	if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		app.renderer.accelerator = (app.renderer.accelerator + 1) % 3;
+	}
+	if (key == GLFW_KEY_U && action == GLFW_PRESS) {
+		app.scene.gpuAnimation = !app.scene.gpuAnimation;
+		app.scene.build();
+		app.renderer.updateBuffers();
+	}
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
@@ -114,7 +129,110 @@ void APIENTRY glDebugOutput(GLenum source, GLenum type, unsigned int id, GLenum
 	std::cout << std::endl;
 }
 
+void App::parse(int argc, char** argv) {
+	for (int i=1;i<argc;i++) {
+		std::string arg = argv[i];
+		bool hasValue = i+1 < argc;
+		if (arg == "--cpu") {
+			cpu = true;
+		} else if (arg == "--headless") {
+			headless = true;
+		} else if (arg == "--threads" && hasValue) {
+			tracer.threads = std::stoi(argv[++i]);
+		} else if (arg == "--streams") {
+			tracer.streams = true;
+		} else if (arg == "--packets") {
+			tracer.packets = true;
+		} else if (arg == "--simd" && hasValue) {
+			tracer.simd = argv[++i];
+		} else if (arg == "--tile" && hasValue) {
+			tracer.scheduler.tileSize = std::max(1, std::stoi(argv[++i]));
+		} else if (arg == "--tile-stats" && hasValue) {
+			tileStats = argv[++i];
+		} else if (arg == "--frames" && hasValue) {
+			frames = std::max(1, std::stoi(argv[++i]));
+		} else if (arg == "--scene" && hasValue) {
+			firstScene = lastScene = std::stoi(argv[++i]);
+		} else if (arg == "--size" && hasValue) {
+			std::string size = argv[++i];
+			width = std::stoi(size.substr(0, size.find('x')));
+			height = std::stoi(size.substr(size.find('x') + 1));
+		} else if (arg == "--output" && hasValue) {
+			output = argv[++i];
+		} else if (arg == "--animate" && hasValue) {
+			std::string range = argv[++i];
+			animate = true;
+			firstFrame = std::stoi(range.substr(0, range.find(':')));
+			lastFrame = range.find(':') == std::string::npos ? firstFrame : std::stoi(range.substr(range.find(':') + 1));
+			lastFrame = std::max(firstFrame, lastFrame);
+		} else if (arg == "--fps" && hasValue) {
+			fps = std::max(1.0f, std::stof(argv[++i]));
+		} else if (arg == "--encoders" && hasValue) {
+			encoders = std::stoi(argv[++i]);
+		} else if (arg == "--accel" && hasValue) {
+			std::string accel = argv[++i];
+			renderer.accelerator = accel == "bvh" ? 1 : accel == "grid" ? 2 : 0;
+		} else if (arg == "--builder" && hasValue) {
+			std::string builder = argv[++i];
+			scene.bvh.builder = builder == "morton" ? BVH::MORTON : BVH::SAH;
+		} else if (arg == "--nodes" && hasValue) {
+			std::string nodes = argv[++i];
+			scene.bvh.wide = nodes == "wide";
+		} else if (arg == "--occluders" && hasValue) {
+			std::string occluders = argv[++i];
+			tracer.occluderCache = occluders == "on";
+		} else if (arg == "--updaters" && hasValue) {
+			std::string updaters = argv[++i];
+			scene.gpuAnimation = updaters == "gpu";
+		} else if (arg == "--ppm") {
+			format = "ppm";
+		} else {
+			std::cout << "unknown argument: " << arg << std::endl;
+		}
+	}
+	if (animate && !cpu) {
+		headless = true;
+	}
+	if (cpu && scene.gpuAnimation) {
+		std::cout << "gpu updaters need the gl renderer, running them on the cpu" << std::endl;
+		scene.gpuAnimation = false;
+	}
+	if (cpu && tracer.packets && renderer.accelerator != 0) {
+		std::cout << "packets only replace linear traversal, tracing per ray with the " << (renderer.accelerator == 1 ? "bvh" : "grid") << std::endl;
+	}
+}
+
+void initDebugOutput() {
+	glEnable(GL_DEBUG_OUTPUT);
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS); 
+	glDebugMessageCallback(glDebugOutput, nullptr);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+}
+
 void App::init() {
+	if (cpu) {
+		camera.init();
+		camera.orient();
+		scene.init();
+		tracer.init();
+		return;
+	}
+
+	if (headless) {
+		if (!context.init()) {
+			std::exit(1);
+		}
+		initDebugOutput();
+		glViewport(0, 0, width, height);
+
+		camera.init();
+		camera.orient();
+		scene.init();
+		renderer.init();
+		renderer.initTarget(width, height);
+		return;
+	}
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
@@ -129,10 +247,7 @@ void App::init() {
 	glfwSetScrollCallback(window, scroll_callback);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-	glEnable(GL_DEBUG_OUTPUT);
-	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS); 
-	glDebugMessageCallback(glDebugOutput, nullptr);
-	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+	initDebugOutput();
 
 	glfwSwapInterval(0);
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -145,6 +260,15 @@ void App::init() {
 }
 
 void App::loop() {
+	if (animate) {
+		animation();
+		return;
+	}
+	if (cpu || headless) {
+		batch();
+		return;
+	}
+
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
 		processInput(window);
@@ -160,6 +284,10 @@ void App::loop() {
 		std::cout << ", reflections: " << renderer.reflections;
 		std::cout << ", lighting: " << renderer.lighting;
 		std::cout << ", shadows: " << renderer.shadows;
+		std::cout << ", accel: " << renderer.accelerator;
+		std::cout << ", updaters: " << (scene.gpuAnimation ? "gpu" : "cpu");
+		std::cout << ", refit: " << scene.bvh.refitTime << " ms, rebuilds: " << scene.bvh.rebuilds;
+		std::cout << ", upload: " << renderer.uploadedBytes / 1024.0 << " kb, stall: " << renderer.stallTime << " ms";
 		std::cout << std::endl;
 
 		camera.update();
@@ -171,6 +299,165 @@ void App::loop() {
 	}
 }
 
+void App::batch() {
+	std::cout << std::fixed << std::setprecision(4);
+	for (int id=firstScene;id<=lastScene;id++) {
+		scene.load(id);
+		tracer.occluders.clear();
+		renderer.time = 0.0f;
+
+		double elapsed = 0.0;
+		long long rays = 0;
+		long long nodes = 0;
+		long long shadows = 0;
+		long long occludersTested = 0;
+		long long occludersHit = 0;
+		float culled = 0.0f;
+		long long uploaded = 0;
+		float stalled = 0.0f;
+		long long pointsLit = 0;
+		long long lightsVisited = 0;
+		if (cpu) {
+			for (int i=0;i<frames;i++) {
+				deltaTime = i == 0 ? 0.0f : 1.0f / 60.0f;
+				tracer.update(deltaTime);
+
+				auto start = std::chrono::steady_clock::now();
+				tracer.draw();
+				elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				rays += tracer.raysTraced;
+				nodes += tracer.nodesVisited;
+				shadows += tracer.shadowRaysTraced;
+				occludersTested += tracer.occludersTested;
+				occludersHit += tracer.occludersHit;
+				pointsLit += tracer.pointsLit;
+				lightsVisited += tracer.lightsVisited;
+			}
+		} else {
+			renderer.updateBuffers();
+			auto start = std::chrono::steady_clock::now();
+			for (int i=0;i<frames;i++) {
+				deltaTime = i == 0 ? 0.0f : 1.0f / 60.0f;
+				renderer.update();
+				culled += renderer.culled;
+				uploaded += renderer.uploadedBytes;
+				stalled += renderer.stallTime;
+				renderer.draw();
+				renderer.read();
+			}
+			renderer.finish();
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		std::string path = output + "_" + std::to_string(id) + "." + format;
+		if (cpu) {
+			tracer.save(path);
+		} else {
+			renderer.save(path);
+			std::cout << "scene: " << id << ", frames: " << frames << ", renderer: headless";
+			std::cout << ", time: " << elapsed << ", fps: " << frames / elapsed << ", culled: " << 100.0f * culled / frames << "%";
+			std::cout << ", upload: " << uploaded / frames / 1024.0 << " kb/frame, stall: " << stalled / frames << " ms/frame";
+			std::cout << ", size: " << width << "x" << height << ", output: " << path;
+			std::cout << std::endl;
+			continue;
+		}
+
+		TileScheduler& scheduler = tracer.scheduler;
+		if (!tileStats.empty()) {
+			std::ofstream file(tileStats + "_" + std::to_string(id) + ".csv");
+			file << "x,y,width,height,thread,ms,stolen\n";
+			for (int i=0;i<scheduler.stats.size();i++) {
+				TileStats& tile = scheduler.stats[i];
+				file << tile.tile.x << "," << tile.tile.y << "," << tile.tile.width << "," << tile.tile.height << "," << tile.thread << "," << tile.time << "," << tile.stolen << "\n";
+			}
+		}
+
+		std::cout << "scene: " << id << ", frames: " << frames << ", threads: " << tracer.threads << ", simd: " << tracer.kernels->name;
+		std::cout << ", time: " << elapsed << ", fps: " << frames / elapsed;
+		std::cout << ", rays: " << rays << ", mrays/s: " << rays / elapsed / 1e6 << ", shadow: " << 100.0 * shadows / std::max(1ll, rays) << "%";
+		if (tracer.occluderCache) {
+			std::cout << ", occluder hits: " << 100.0 * occludersHit / std::max(1ll, occludersTested) << "% of " << occludersTested;
+		}
+		std::cout << ", lights/point: " << (double)lightsVisited / std::max(1ll, pointsLit);
+		if (renderer.accelerator != 0) {
+			std::cout << (renderer.accelerator == 2 ? ", cells/ray: " : ", nodes/ray: ") << (double)nodes / std::max(1ll, rays);
+		}
+		std::cout << ", tiles: " << scheduler.stats.size() << ", steals: " << scheduler.steals << ", splits: " << scheduler.splits;
+		std::cout << ", busy: " << 100.0 * scheduler.busyTime / (scheduler.threads * scheduler.frameTime) << "%";
+		if (tracer.packets && renderer.accelerator == 0) {
+			PacketStats& packets = tracer.packetStats;
+			std::cout << ", packets: " << packets.packets << ", culled: " << 100.0 * packets.culled / std::max(1ll, packets.tests) << "%";
+			std::cout << ", ray hits: " << 100.0 * packets.rayHits / std::max(1ll, packets.rayTests) << "%";
+		}
+		std::cout << ", size: " << width << "x" << height << ", output: " << path;
+		std::cout << std::endl;
+	}
+}
+
+void App::animation() {
+	if (encoders <= 0) {
+		encoders = std::max(1u, std::thread::hardware_concurrency() / 2);
+	}
+	encoder.init(encoders);
+
+	std::cout << std::fixed << std::setprecision(4);
+	for (int id=firstScene;id<=lastScene;id++) {
+		scene.load(id);
+		tracer.occluders.clear();
+		if (headless) {
+			renderer.updateBuffers();
+		}
+		encoder.written = 0;
+		encoder.failed = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (int i=firstFrame;i<=lastFrame;i++) {
+			// time comes from the frame index rather than the clock, so the sequence is the same however long frames take
+			renderer.time = i / fps;
+			deltaTime = 0.0f;
+			if (cpu) {
+				tracer.update(deltaTime);
+				tracer.draw();
+				encoder.push(framePath(id, i), tracer.width, tracer.height, tracer.framebuffer);
+			} else {
+				renderer.update();
+				renderer.draw();
+				// readback lags one frame behind
+				if (renderer.read()) {
+					encoder.push(framePath(id, i - 1), renderer.targetWidth, renderer.targetHeight, renderer.framebuffer);
+				}
+			}
+		}
+		if (headless) {
+			renderer.finish();
+			encoder.push(framePath(id, lastFrame), renderer.targetWidth, renderer.targetHeight, renderer.framebuffer);
+		}
+		encoder.finish();
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		int frames = lastFrame - firstFrame + 1;
+		std::cout << "scene: " << id << ", frames: " << firstFrame << "-" << lastFrame << ", step: " << 1.0f / fps;
+		std::cout << ", renderer: " << (cpu ? "cpu" : "headless") << ", encoders: " << encoder.threads;
+		std::cout << ", time: " << elapsed << ", fps: " << frames / elapsed;
+		std::cout << ", written: " << encoder.written << ", failed: " << encoder.failed;
+		std::cout << ", output: " << framePath(id, firstFrame) << std::endl;
+	}
+	encoder.exit();
+}
+
+std::string App::framePath(int scene, int frame) {
+	std::ostringstream path;
+	path << output << "_" << scene << "_" << std::setw(5) << std::setfill('0') << frame << "." << format;
+	return path.str();
+}
+
 void App::exit() {
+	if (cpu) {
+		return;
+	}
+	if (headless) {
+		context.exit();
+		return;
+	}
 	glfwTerminate();
 }
@@ -3,9 +3,13 @@
 #include "camera.hpp"
 #include "scene.hpp"
 #include "renderer.hpp"
+#include "tracer.hpp"
+#include "headless.hpp"
+#include "encoder.hpp"
 
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <string>
 
 class App {
 public:
@@ -13,6 +17,23 @@ public:
 	int height = 1080;
 	GLFWwindow* window;
 
+	bool cpu = false;
+	bool headless = false;
+	HeadlessContext context;
+	int frames = 1;
+	int firstScene = 1;
+	int lastScene = 10;
+	std::string output = "euclid";
+	std::string format = "png";
+	std::string tileStats = "";
+
+	bool animate = false; // offline frame sequence at a fixed step
+	int firstFrame = 0;
+	int lastFrame = 59;
+	float fps = 60.0f;
+	int encoders = 0; // 0 = half the cores
+	Encoder encoder;
+
 	float time;
 	float deltaTime;
 
@@ -23,9 +44,14 @@ public:
 	Camera camera;
 	Scene scene;
 	Renderer renderer;
+	Tracer tracer;
 
+	void parse(int argc, char** argv);
 	void init();
 	void loop();
+	void batch();
+	void animation();
+	std::string framePath(int scene, int frame);
 	void exit();
 };
 
@@ -0,0 +1,626 @@
+#include "bvh.hpp"
+
+#include "objects.hpp"
+#include "scheduler.hpp"
+#include "sort.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
+
+struct Bin {
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+	int count = 0;
+
+	void grow(glm::vec3 lo, glm::vec3 hi) {
+		min = glm::min(min, lo);
+		max = glm::max(max, hi);
+	}
+};
+
+void BVH::build(const std::vector<Sphere>& spheres, const std::vector<Quad>& quads, const std::vector<Cube>& cubes) {
+	auto start = std::chrono::steady_clock::now();
+	this->spheres = &spheres;
+	this->quads = &quads;
+	this->cubes = &cubes;
+	this->instances = nullptr;
+	references.clear();
+	mins.clear();
+	maxs.clear();
+	centers.clear();
+	int count = spheres.size() + quads.size() + cubes.size();
+	references.reserve(count);
+	mins.reserve(count);
+	maxs.reserve(count);
+	centers.reserve(count);
+	for (int i=0;i<spheres.size();i++) {
+		add(SPHERE, i, spheres[i].bounds);
+	}
+	for (int i=0;i<quads.size();i++) {
+		add(QUAD, i, quads[i].bounds);
+	}
+	for (int i=0;i<cubes.size();i++) {
+		add(CUBE, i, cubes[i].bounds);
+	}
+	construct();
+	buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BVH::build(const std::vector<Instance>& instances) {
+	auto start = std::chrono::steady_clock::now();
+	this->spheres = nullptr;
+	this->quads = nullptr;
+	this->cubes = nullptr;
+	this->instances = &instances;
+	references.clear();
+	mins.clear();
+	maxs.clear();
+	centers.clear();
+	for (int i=0;i<instances.size();i++) {
+		add(INSTANCE, i, instances[i].bounds);
+	}
+	construct();
+	buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// builds the nodes over the added references
+void BVH::construct() {
+	nodes.clear();
+	parents.clear();
+	mortonTooDeep = false;
+	if (builder == MORTON) {
+		buildMorton();
+		// the karras build has no depth bound, clustered codes and ties can outgrow the traversal
+		// stacks. rebuild those with sah from the sorted references
+		if (depth() > MAX_DEPTH - 1) {
+			mortonTooDeep = true;
+			nodes.clear();
+			parents.clear();
+			for (int i=0;i<references.size();i++) {
+				centers[i] = (mins[i] + maxs[i]) * 0.5f;
+			}
+		}
+	}
+	if ((builder != MORTON || mortonTooDeep) && !references.empty()) {
+		nodes.reserve(references.size() * 2);
+		nodes.push_back({});
+		parents.push_back(-1);
+		subdivide(0, 0, references.size(), 0);
+	}
+
+	leaves[SPHERE].assign(spheres ? spheres->size() : 0, -1);
+	leaves[QUAD].assign(quads ? quads->size() : 0, -1);
+	leaves[CUBE].assign(cubes ? cubes->size() : 0, -1);
+	leaves[INSTANCE].assign(instances ? instances->size() : 0, -1);
+	parallel(nodes.size(), [&](int begin, int end) {
+		for (int i=begin;i<end;i++) {
+			for (int k=nodes[i].start;k<nodes[i].start+nodes[i].count;k++) {
+				leaves[references[k] >> TYPE_SHIFT][references[k] & INDEX_MASK] = i;
+			}
+		}
+	});
+	dirty.assign(nodes.size(), 0);
+	builtCost = cost();
+	wideNodes.clear();
+	wideSources.clear();
+	if (wide) {
+		buildWide();
+	}
+}
+
+// recomputes the bounds of the leaves holding the moved references and of their ancestors.
+// children always come after their parent, so going through the nodes by descending index
+// updates both children before the parent
+void BVH::refit(const std::vector<int>& moved, bool all) {
+	auto start = std::chrono::steady_clock::now();
+	queue.clear();
+	// walking up from the moved leaves only pays off while they dirty few nodes, past a quarter of
+	// them one pass over all nodes is cheaper. that many leaves moving dirty more than that anyway
+	bool full = all || moved.size() > references.size() / 4;
+	for (int i=0;i<moved.size() && !full;i++) {
+		int node = leaves[moved[i] >> TYPE_SHIFT][moved[i] & INDEX_MASK];
+		while (node >= 0 && !dirty[node]) {
+			dirty[node] = 1;
+			queue.push_back(node);
+			node = parents[node];
+		}
+		full = queue.size() > nodes.size() / 4;
+	}
+
+	if (full) {
+		for (int i=0;i<queue.size();i++) {
+			dirty[queue[i]] = 0;
+		}
+		for (int i=nodes.size()-1;i>=0;i--) {
+			refitNode(i);
+		}
+		refitNodes = nodes.size();
+	} else if (queue.size() > 256) {
+		for (int i=nodes.size()-1;i>=0;i--) {
+			if (dirty[i]) {
+				refitNode(i);
+				dirty[i] = 0;
+			}
+		}
+		refitNodes = queue.size();
+	} else {
+		std::sort(queue.begin(), queue.end(), std::greater<int>());
+		for (int i=0;i<queue.size();i++) {
+			refitNode(queue[i]);
+			dirty[queue[i]] = 0;
+		}
+		refitNodes = queue.size();
+	}
+	refits++;
+	if (full) {
+		for (int i=0;i<wideNodes.size();i++) {
+			quantize(i);
+		}
+	} else if (!wideNodes.empty()) {
+		// only the wide nodes with a refit child change
+		for (int i=0;i<queue.size();i++) {
+			queue[i] = wideOwners[queue[i]];
+		}
+		std::sort(queue.begin(), queue.end());
+		queue.erase(std::unique(queue.begin(), queue.end()), queue.end());
+		for (int i=0;i<queue.size();i++) {
+			if (queue[i] >= 0) {
+				quantize(queue[i]);
+			}
+		}
+	}
+
+	if (refitNodes > 0 && refits % costInterval == 0 && cost() > builtCost * rebuildThreshold) {
+		if (instances) {
+			build(*instances);
+		} else {
+			build(*spheres, *quads, *cubes);
+		}
+		rebuilds++;
+	}
+	refitTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BVH::refitNode(int node) {
+	BVHNode& n = nodes[node];
+	if (n.count == 0) {
+		n.min = glm::min(nodes[n.start].min, nodes[n.start + 1].min);
+		n.max = glm::max(nodes[n.start].max, nodes[n.start + 1].max);
+		return;
+	}
+	glm::vec3 lo = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 hi = glm::vec3(-std::numeric_limits<float>::max());
+	for (int k=n.start;k<n.start+n.count;k++) {
+		int index = references[k] & INDEX_MASK;
+		if (references[k] >> TYPE_SHIFT == SPHERE) {
+			// sphere bounds are already min and max
+			const Sphere& sphere = (*spheres)[index];
+			lo = glm::min(lo, glm::vec3(sphere.bounds[0]));
+			hi = glm::max(hi, glm::vec3(sphere.bounds[1]));
+		} else {
+			glm::vec3 a, b;
+			bounds(references[k], a, b);
+			lo = glm::min(lo, a);
+			hi = glm::max(hi, b);
+		}
+	}
+	n.min = lo;
+	n.max = hi;
+}
+
+// collapses the binary nodes top down. every wide node starts from the two children of a binary
+// node and keeps opening its largest interior child until it holds four
+void BVH::buildWide() {
+	if (nodes.empty()) {
+		return;
+	}
+	wideNodes.push_back({});
+	wideSources.insert(wideSources.end(), {0, -1, -1, -1});
+	if (nodes[0].count == 0) {
+		wideSources[0] = nodes[0].start;
+		wideSources[1] = nodes[0].start + 1;
+	}
+	for (int index=0;index<wideNodes.size();index++) {
+		int* sources = &wideSources[index*4];
+		int count = sources[1] < 0 ? 1 : 2;
+		while (count < 4) {
+			int best = -1;
+			float bestArea = -1.0f;
+			for (int c=0;c<count;c++) {
+				float a = area(nodes[sources[c]].min, nodes[sources[c]].max);
+				if (nodes[sources[c]].count == 0 && a > bestArea) {
+					best = c;
+					bestArea = a;
+				}
+			}
+			if (best < 0) {
+				break;
+			}
+			int node = sources[best];
+			sources[best] = nodes[node].start;
+			sources[count++] = nodes[node].start + 1;
+		}
+		for (int c=0;c<4;c++) {
+			int node = sources[c];
+			if (node < 0) {
+				wideNodes[index].children[c] = -1;
+			} else if (nodes[node].count > 0) {
+				wideNodes[index].children[c] = WIDE_LEAF | nodes[node].count << 23 | nodes[node].start;
+			} else {
+				// the new node's sources start as the binary children, see above
+				wideNodes[index].children[c] = wideNodes.size();
+				wideNodes.push_back({});
+				wideSources.insert(wideSources.end(), {nodes[node].start, nodes[node].start + 1, -1, -1});
+				sources = &wideSources[index*4];
+			}
+		}
+	}
+	wideOwners.assign(nodes.size(), -1);
+	for (int i=0;i<wideSources.size();i++) {
+		if (wideSources[i] >= 0) {
+			wideOwners[wideSources[i]] = i / 4;
+		}
+	}
+	for (int i=0;i<wideNodes.size();i++) {
+		quantize(i);
+	}
+}
+
+// child boxes relative to the union of the children, each bound rounded outwards so the decoded
+// box origin + q * 2^e always contains the exact one
+void BVH::quantize(int index) {
+	WideNode& node = wideNodes[index];
+	const int* sources = &wideSources[index*4];
+	glm::vec3 lo = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 hi = glm::vec3(-std::numeric_limits<float>::max());
+	for (int c=0;c<4 && sources[c] >= 0;c++) {
+		lo = glm::min(lo, nodes[sources[c]].min);
+		hi = glm::max(hi, nodes[sources[c]].max);
+	}
+	node.origin = lo;
+	node.exponents = 0;
+	for (int axis=0;axis<3;axis++) {
+		// smallest power of two cell with 255 cells covering the extent
+		unsigned int bits = glm::floatBitsToUint((hi[axis] - lo[axis]) / 255.0f);
+		int e = std::clamp((int)(bits >> 23 & 0xff) - 127 + ((bits & 0x7fffff) != 0), -126, 126);
+		for (;;e++) {
+			float scale = glm::uintBitsToFloat((unsigned int)(e + 127) << 23);
+			float inverse = glm::uintBitsToFloat((unsigned int)(127 - e) << 23);
+			bool fits = true;
+			node.lo[axis] = 0;
+			node.hi[axis] = 0;
+			for (int c=0;c<4 && sources[c] >= 0;c++) {
+				float min = nodes[sources[c]].min[axis];
+				float max = nodes[sources[c]].max[axis];
+				int qlo = std::clamp((int)((min - lo[axis]) * inverse), 0, 255);
+				int qhi = std::clamp((int)((max - lo[axis]) * inverse) + 1, 0, 255);
+				while (qlo > 0 && lo[axis] + qlo * scale > min) {
+					qlo--;
+				}
+				while (qhi > 0 && lo[axis] + (qhi - 1) * scale >= max) {
+					qhi--;
+				}
+				fits = fits && lo[axis] + qhi * scale >= max;
+				node.lo[axis] |= (unsigned int)qlo << 8*c;
+				node.hi[axis] |= (unsigned int)qhi << 8*c;
+			}
+			if (fits || e >= 126) {
+				node.exponents |= (unsigned int)(e + 127) << 8*axis;
+				break;
+			}
+		}
+	}
+}
+
+void BVH::bounds(int reference, glm::vec3& lo, glm::vec3& hi) {
+	int type = reference >> TYPE_SHIFT;
+	int index = reference & INDEX_MASK;
+	const glm::vec4* b = type == SPHERE ? (*spheres)[index].bounds : type == QUAD ? (*quads)[index].bounds : type == CUBE ? (*cubes)[index].bounds : (*instances)[index].bounds;
+	lo = glm::min(glm::vec3(b[0]), glm::vec3(b[1]));
+	hi = glm::max(glm::vec3(b[0]), glm::vec3(b[1]));
+}
+
+// expected cost of a ray through the root, relative to one primitive test
+float BVH::cost() {
+	if (nodes.empty()) {
+		return 0.0f;
+	}
+	float sum = 0.0f;
+	for (int i=0;i<nodes.size();i++) {
+		float a = area(nodes[i].min, nodes[i].max);
+		sum += nodes[i].count > 0 ? a * nodes[i].count * intersectionCost : a * traversalCost;
+	}
+	return sum / std::max(area(nodes[0].min, nodes[0].max), 1e-12f);
+}
+
+void BVH::add(int type, int index, const glm::vec4 bounds[2]) {
+	// quad and cube bounds are corner to opposite corner, not necessarily min to max
+	glm::vec3 lo = glm::min(glm::vec3(bounds[0]), glm::vec3(bounds[1]));
+	glm::vec3 hi = glm::max(glm::vec3(bounds[0]), glm::vec3(bounds[1]));
+	references.push_back(type << TYPE_SHIFT | index);
+	mins.push_back(lo);
+	maxs.push_back(hi);
+	centers.push_back((lo + hi) * 0.5f);
+}
+
+// linear bvh after karras 2012. the references are sorted by the morton code of their center,
+// every internal node finds its range and split independently, and bounds are merged bottom up
+// by whichever child finishes second. nodes come out in the same layout as the sah build with
+// the children of internal node i in the pair at 2i+1
+void BVH::buildMorton() {
+	int n = references.size();
+	if (n == 0) {
+		return;
+	}
+	if (scheduler.queues.empty()) {
+		scheduler.init(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+	}
+
+	glm::vec3 lo = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 hi = glm::vec3(-std::numeric_limits<float>::max());
+	for (int i=0;i<n;i++) {
+		lo = glm::min(lo, centers[i]);
+		hi = glm::max(hi, centers[i]);
+	}
+	int axisBits = mortonBits == 30 ? 10 : 21;
+	glm::vec3 scale = (float)((1 << axisBits) - 1) / glm::max(hi - lo, glm::vec3(1e-6f));
+
+	codes.resize(n);
+	order.resize(n);
+	parallel(n, [&](int begin, int end) {
+		for (int i=begin;i<end;i++) {
+			glm::uvec3 cell = glm::uvec3((centers[i] - lo) * scale);
+			codes[i] = mortonBits == 30 ? morton3(cell.x, cell.y, cell.z) : morton3Wide(cell.x, cell.y, cell.z);
+			order[i] = i;
+		}
+	});
+	radixSort(codes, order, mortonBits, scheduler);
+
+	std::vector<int> sorted(n);
+	std::vector<glm::vec3> sortedMins(n);
+	std::vector<glm::vec3> sortedMaxs(n);
+	parallel(n, [&](int begin, int end) {
+		for (int i=begin;i<end;i++) {
+			sorted[i] = references[order[i]];
+			sortedMins[i] = mins[order[i]];
+			sortedMaxs[i] = maxs[order[i]];
+		}
+	});
+	references.swap(sorted);
+	mins.swap(sortedMins);
+	maxs.swap(sortedMaxs);
+
+	nodes.resize(2*n - 1);
+	parents.resize(2*n - 1);
+	if (n == 1) {
+		nodes[0] = {mins[0], 0, maxs[0], 1};
+		parents[0] = -1;
+		return;
+	}
+
+	// node of each internal node (first n-1) and leaf (last n), and their parents as internal indices
+	slots.resize(2*n - 1);
+	internalParents.resize(n - 1);
+	leafParents.resize(n);
+	slots[0] = 0;
+	internalParents[0] = -1;
+	parallel(n - 1, [&](int begin, int end) {
+		for (int i=begin;i<end;i++) {
+			int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+			int minDelta = delta(i, i - d);
+			int maxLength = 2;
+			while (delta(i, i + maxLength*d) > minDelta) {
+				maxLength *= 2;
+			}
+			int length = 0;
+			for (int t=maxLength/2;t>=1;t/=2) {
+				if (delta(i, i + (length + t)*d) > minDelta) {
+					length += t;
+				}
+			}
+			int j = i + length*d;
+			int nodeDelta = delta(i, j);
+			int split = 0;
+			for (int t=(length + 1)/2, div=2;;div*=2, t=(length + div - 1)/div) {
+				if (delta(i, i + (split + t)*d) > nodeDelta) {
+					split += t;
+				}
+				if (t <= 1) {
+					break;
+				}
+			}
+			int gamma = i + split*d + std::min(d, 0);
+
+			int children[2] = {gamma, gamma + 1};
+			bool leaf[2] = {std::min(i, j) == gamma, std::max(i, j) == gamma + 1};
+			for (int c=0;c<2;c++) {
+				int slot = 2*i + 1 + c;
+				if (leaf[c]) {
+					slots[n - 1 + children[c]] = slot;
+					leafParents[children[c]] = i;
+					nodes[slot] = {mins[children[c]], children[c], maxs[children[c]], 1};
+				} else {
+					slots[children[c]] = slot;
+					internalParents[children[c]] = i;
+				}
+			}
+		}
+	});
+
+	// the second child to arrive at a node merges the bounds and carries on upwards
+	std::vector<std::atomic<int>> arrived(n - 1);
+	parallel(n - 1, [&](int begin, int end) {
+		for (int i=begin;i<end;i++) {
+			nodes[slots[i]].start = 2*i + 1;
+			nodes[slots[i]].count = 0;
+			parents[2*i + 1] = slots[i];
+			parents[2*i + 2] = slots[i];
+		}
+	});
+	parents[0] = -1;
+	parallel(n, [&](int begin, int end) {
+		for (int leaf=begin;leaf<end;leaf++) {
+			int node = leafParents[leaf];
+			while (node >= 0 && arrived[node].fetch_add(1, std::memory_order_acq_rel) == 1) {
+				BVHNode& current = nodes[slots[node]];
+				current.min = glm::min(nodes[2*node + 1].min, nodes[2*node + 2].min);
+				current.max = glm::max(nodes[2*node + 1].max, nodes[2*node + 2].max);
+				node = internalParents[node];
+			}
+		}
+	});
+}
+
+// deepest leaf below the root, which is at depth 0
+int BVH::depth() {
+	int deepest = 0;
+	std::vector<glm::ivec2> stack; // node, depth
+	if (!nodes.empty()) {
+		stack.push_back(glm::ivec2(0, 0));
+	}
+	while (!stack.empty()) {
+		glm::ivec2 top = stack.back();
+		stack.pop_back();
+		deepest = std::max(deepest, top.y);
+		if (nodes[top.x].count == 0) {
+			stack.push_back(glm::ivec2(nodes[top.x].start, top.y + 1));
+			stack.push_back(glm::ivec2(nodes[top.x].start + 1, top.y + 1));
+		}
+	}
+	return deepest;
+}
+
+// length of the common prefix of the codes at i and j, with the index breaking ties
+int BVH::delta(int i, int j) {
+	if (j < 0 || j >= codes.size()) {
+		return -1;
+	}
+	if (codes[i] == codes[j]) {
+		return 64 + __builtin_clz((unsigned int)(i ^ j));
+	}
+	return __builtin_clzll(codes[i] ^ codes[j]);
+}
+
+// static chunks over the morton scheduler, sequential until it has been started
+void BVH::parallel(int count, std::function<void(int begin, int end)> work) {
+	int chunks = std::max(1, std::min(scheduler.threads * 4, count / 1024));
+	if (chunks == 1 || scheduler.queues.empty()) {
+		work(0, count);
+		return;
+	}
+	std::vector<Tile> tiles;
+	for (int c=0;c<chunks;c++) {
+		tiles.push_back({c, 0, 1, 1});
+	}
+	scheduler.run(tiles, [&](const Tile& tile) {
+		work((long long)count*tile.x/chunks, (long long)count*(tile.x + 1)/chunks);
+	});
+}
+
+void BVH::makeLeaf(int node, int begin, int end) {
+	nodes[node].start = begin;
+	nodes[node].count = end - begin;
+}
+
+void BVH::subdivide(int node, int begin, int end, int depth) {
+	glm::vec3 lo = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 hi = glm::vec3(-std::numeric_limits<float>::max());
+	glm::vec3 centerLo = lo;
+	glm::vec3 centerHi = hi;
+	for (int i=begin;i<end;i++) {
+		lo = glm::min(lo, mins[i]);
+		hi = glm::max(hi, maxs[i]);
+		centerLo = glm::min(centerLo, centers[i]);
+		centerHi = glm::max(centerHi, centers[i]);
+	}
+	nodes[node].min = lo;
+	nodes[node].max = hi;
+
+	int count = end - begin;
+	if (count <= maxLeafSize || depth >= MAX_DEPTH - 1) {
+		makeLeaf(node, begin, end);
+		return;
+	}
+
+	// best binned split over the three axes
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	int bestBin = 0;
+	std::vector<Bin> bin(bins);
+	std::vector<float> leftArea(bins);
+	std::vector<int> leftCount(bins);
+	for (int axis=0;axis<3;axis++) {
+		float extent = centerHi[axis] - centerLo[axis];
+		if (extent <= 0.0f) {
+			continue;
+		}
+		float scale = bins / extent;
+		std::fill(bin.begin(), bin.end(), Bin());
+		for (int i=begin;i<end;i++) {
+			int b = std::min(bins - 1, (int)((centers[i][axis] - centerLo[axis]) * scale));
+			bin[b].grow(mins[i], maxs[i]);
+			bin[b].count++;
+		}
+		Bin left;
+		for (int b=0;b<bins-1;b++) {
+			left.grow(bin[b].min, bin[b].max);
+			left.count += bin[b].count;
+			leftArea[b] = left.count > 0 ? area(left.min, left.max) : 0.0f;
+			leftCount[b] = left.count;
+		}
+		Bin right;
+		for (int b=bins-1;b>0;b--) {
+			right.grow(bin[b].min, bin[b].max);
+			right.count += bin[b].count;
+			float rightArea = right.count > 0 ? area(right.min, right.max) : 0.0f;
+			float cost = leftArea[b-1] * leftCount[b-1] + rightArea * right.count;
+			if (leftCount[b-1] > 0 && right.count > 0 && cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	float leafCost = count * intersectionCost;
+	float splitCost = traversalCost + intersectionCost * bestCost / std::max(area(lo, hi), 1e-12f);
+	if (bestAxis < 0 || (splitCost >= leafCost && count <= maxLeafSize * 4)) {
+		makeLeaf(node, begin, end);
+		return;
+	}
+
+	float scale = bins / (centerHi[bestAxis] - centerLo[bestAxis]);
+	int mid = begin;
+	for (int i=begin;i<end;i++) {
+		int b = std::min(bins - 1, (int)((centers[i][bestAxis] - centerLo[bestAxis]) * scale));
+		if (b < bestBin) {
+			std::swap(references[i], references[mid]);
+			std::swap(mins[i], mins[mid]);
+			std::swap(maxs[i], maxs[mid]);
+			std::swap(centers[i], centers[mid]);
+			mid++;
+		}
+	}
+
+	int left = nodes.size();
+	nodes.push_back({});
+	nodes.push_back({});
+	parents.push_back(node);
+	parents.push_back(node);
+	nodes[node].start = left;
+	nodes[node].count = 0;
+	subdivide(left, begin, mid, depth + 1);
+	subdivide(left + 1, mid, end, depth + 1);
+}
+
+float BVH::area(glm::vec3 min, glm::vec3 max) {
+	glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+	return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "objects.hpp"
+#include "scheduler.hpp"
+
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+// matches Node in shader.frag (std430)
+struct BVHNode {
+	glm::vec3 min;
+	int start; // interior: left child, the right one follows it. leaf: first reference
+	glm::vec3 max;
+	int count; // references in a leaf, 0 for interior nodes
+};
+
+// matches WideNode in shader.frag (std430), one 64 byte cache line. up to four children whose
+// boxes are stored as 8 bit offsets on a grid starting at origin, with a power of two cell size
+// per axis so the offsets decode exactly, after ylitie et al. 2017
+struct WideNode {
+	glm::vec3 origin;
+	unsigned int exponents; // biased float exponent of the cell size, x in the low byte
+	unsigned int lo[3]; // per axis, child c in byte c, rounded down
+	unsigned int hi[3]; // per axis, child c in byte c, rounded up
+	int children[4]; // wide node, leaf (WIDE_LEAF | count << 23 | first reference) or -1
+	int pad[2];
+};
+
+// binned sah bvh over the bounded primitives, or over instances for the top level of instanced
+// geometry. references hold the primitive type in the top bits and the index into its scene
+// vector in the rest. animated scenes refit the nodes above the primitives that moved and only
+// rebuild once the sah cost has degraded too far
+class BVH {
+public:
+	static const int SPHERE = 0;
+	static const int QUAD = 1;
+	static const int CUBE = 2;
+	static const int INSTANCE = 3;
+	static const int TYPE_SHIFT = 28;
+	static const int INDEX_MASK = (1 << TYPE_SHIFT) - 1;
+	static const int MAX_DEPTH = 64; // traversal stack size in shader.frag
+	static const int SAH = 0;
+	static const int MORTON = 1;
+	static const int WIDE_LEAF = (int)0x80000000;
+	static const int WIDE_STACK = 3*MAX_DEPTH + 1; // wide traversal stack size in shader.frag
+
+	int builder = SAH;
+	int bins = 16;
+	int maxLeafSize = 4;
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.0f;
+
+	float rebuildThreshold = 1.5f; // rebuild when the cost grows past this factor of the built cost
+	int costInterval = 16; // refits between cost checks
+	int mortonBits = 63; // 30 or 63
+	int threads = 0; // morton build threads, 0 = all cores
+	bool wide = false; // also collapse the nodes into quantized 4-wide nodes for traversal
+
+	std::vector<BVHNode> nodes;
+	std::vector<int> references;
+	std::vector<int> parents;
+	std::vector<int> leaves[4]; // per type, leaf holding each primitive
+	std::vector<WideNode> wideNodes;
+	std::vector<int> wideSources; // binary node behind each wide child, 4 per wide node
+	std::vector<int> wideOwners; // wide node holding each binary node as a child, or -1
+
+	float builtCost = 0.0f;
+	float buildTime = 0.0f; // ms, last build
+	float refitTime = 0.0f; // ms, last refit
+	int refitNodes = 0; // nodes recomputed by the last refit
+	int refits = 0;
+	int rebuilds = 0; // triggered by refits
+	bool mortonTooDeep = false; // last morton build exceeded MAX_DEPTH and fell back to sah
+
+	const std::vector<Sphere>* spheres = nullptr;
+	const std::vector<Quad>* quads = nullptr;
+	const std::vector<Cube>* cubes = nullptr;
+	const std::vector<Instance>* instances = nullptr;
+	std::vector<glm::vec3> mins;
+	std::vector<glm::vec3> maxs;
+	std::vector<glm::vec3> centers;
+	std::vector<unsigned char> dirty;
+	std::vector<int> queue;
+
+	TileScheduler scheduler;
+	std::vector<unsigned long long> codes;
+	std::vector<int> order;
+	std::vector<int> slots; // morton build: node of internal node i, then of leaf i
+	std::vector<int> internalParents;
+	std::vector<int> leafParents;
+
+	void build(const std::vector<Sphere>& spheres, const std::vector<Quad>& quads, const std::vector<Cube>& cubes);
+	void build(const std::vector<Instance>& instances);
+	void refit(const std::vector<int>& moved, bool all = false); // all: every node, whatever moved
+	float cost();
+
+	void add(int type, int index, const glm::vec4 bounds[2]);
+	void construct();
+	void subdivide(int node, int begin, int end, int depth);
+	void buildMorton();
+	int delta(int i, int j);
+	int depth();
+	void parallel(int count, std::function<void(int begin, int end)> work);
+	void makeLeaf(int node, int begin, int end);
+	void refitNode(int node);
+	void buildWide();
+	void quantize(int index);
+	void bounds(int reference, glm::vec3& lo, glm::vec3& hi);
+	static float area(glm::vec3 min, glm::vec3 max);
+};
@@ -27,14 +27,7 @@ void Camera::update() {
 		yaw += 360.0;
 	}
 
-	glm::vec3 direction;
-	direction.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-	direction.y = sin(glm::radians(pitch));
-	direction.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-
-	front = glm::normalize(direction);
-	right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
-	up = glm::normalize(glm::cross(right, front));
+	orient();
 
 	float d = speed * app.deltaTime;
 	if (glfwGetKey(app.window, GLFW_KEY_LEFT_SHIFT)) {
@@ -62,5 +55,36 @@ void Camera::update() {
 		position -= d * up;
 	}
 
-	view = glm::lookAt(position, position + direction, glm::vec3(0.0f, 1.0f, 0.0f));
+	view = glm::lookAt(position, position + front, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+void Camera::orient() {
+	glm::vec3 direction;
+	direction.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+	direction.y = sin(glm::radians(pitch));
+	direction.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+
+	front = glm::normalize(direction);
+	right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
+	up = glm::normalize(glm::cross(right, front));
+
+	view = glm::lookAt(position, position + front, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// side planes of the pyramid spanned by the corner rays of primaryRay in shader.frag, as normal and
+// offset with the normals pointing inwards. aspect is height over width
+void Camera::frustum(float aspect, glm::vec4 planes[4]) {
+	glm::mat4 inverseView = glm::inverse(view);
+	glm::vec3 origin = glm::vec3(inverseView[3]);
+	glm::vec3 forward = -glm::vec3(inverseView[2]);
+	glm::vec3 x = glm::vec3(inverseView[0]) * (float)fov / 180.0f * 3.1415926f;
+	glm::vec3 y = glm::vec3(inverseView[1]) * aspect * (float)fov / 180.0f * 3.1415926f;
+	glm::vec3 corners[4] = {forward - x - y, forward + x - y, forward + x + y, forward - x + y};
+	for (int i=0;i<4;i++) {
+		glm::vec3 normal = glm::cross(corners[i], corners[(i+1)%4]);
+		if (glm::dot(normal, forward) < 0.0f) {
+			normal = -normal;
+		}
+		planes[i] = glm::vec4(normal, -glm::dot(normal, origin));
+	}
 }
@@ -20,4 +20,6 @@ public:
 
 	void init();
 	void update();
+	void orient();
+	void frustum(float aspect, glm::vec4 planes[4]);
 };
@@ -0,0 +1,79 @@
+#include "encoder.hpp"
+
+#include "image.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+Encoder::~Encoder() {
+	exit();
+}
+
+void Encoder::init(int threads) {
+	exit();
+	this->threads = std::max(1, threads);
+	capacity = this->threads * 2;
+	written = 0;
+	failed = 0;
+	stopping = false;
+	for (int i=0;i<this->threads;i++) {
+		workers.push_back(std::thread(&Encoder::worker, this));
+	}
+}
+
+void Encoder::push(std::string path, int width, int height, const std::vector<glm::vec4>& pixels) {
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&]() { return jobs.size() < capacity; });
+	jobs.push_back({path, width, height, pixels});
+	queued.notify_one();
+}
+
+void Encoder::finish() {
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&]() { return jobs.empty() && active == 0; });
+}
+
+void Encoder::exit() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	queued.notify_all();
+	for (int i=0;i<workers.size();i++) {
+		workers[i].join();
+	}
+	workers.clear();
+}
+
+void Encoder::worker() {
+	while (true) {
+		EncodeJob job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued.wait(lock, [&]() { return stopping || !jobs.empty(); });
+			if (jobs.empty()) {
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			active++;
+		}
+		done.notify_all();
+
+		bool ok = writeImage(job.path, job.width, job.height, job.pixels);
+		if (!ok) {
+			std::cout << "failed to write " << job.path << std::endl;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active--;
+			written += ok;
+			failed += !ok;
+		}
+		done.notify_all();
+	}
+}
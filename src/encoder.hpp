@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct EncodeJob {
+	std::string path;
+	int width;
+	int height;
+	std::vector<glm::vec4> pixels;
+};
+
+// pool of threads writing finished frames to disk while the next ones render. push blocks once
+// capacity frames are waiting so a slow disk can't pile up unbounded copies of the framebuffer.
+class Encoder {
+public:
+	int threads = 1;
+	int capacity = 4;
+
+	int written = 0;
+	int failed = 0;
+
+	std::vector<std::thread> workers;
+	std::deque<EncodeJob> jobs;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::condition_variable done;
+	int active = 0;
+	bool stopping = false;
+
+	~Encoder();
+
+	void init(int threads);
+	void push(std::string path, int width, int height, const std::vector<glm::vec4>& pixels);
+	void finish();
+	void exit();
+
+	void worker();
+};
@@ -0,0 +1,126 @@
+#include "grid.hpp"
+
+#include "objects.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+void Grid::build(const std::vector<Sphere>& spheres) {
+	build(spheres.size(), [&](int i, glm::vec3& lo, glm::vec3& hi) {
+		lo = glm::vec3(spheres[i].bounds[0]);
+		hi = glm::vec3(spheres[i].bounds[1]);
+		return true;
+	});
+}
+
+// lights without a radius reach everything and are left out. sweeps, when given, holds lo and hi of
+// the box each light moves in
+void Grid::build(const std::vector<Light>& lights, const std::vector<glm::vec3>& sweeps) {
+	build(lights.size(), [&](int i, glm::vec3& lo, glm::vec3& hi) {
+		float radius = lights[i].attenuation.x;
+		lo = (sweeps.empty() ? glm::vec3(lights[i].position) : sweeps[2*i]) - glm::vec3(radius);
+		hi = (sweeps.empty() ? glm::vec3(lights[i].position) : sweeps[2*i + 1]) + glm::vec3(radius);
+		return radius > 0.0f;
+	});
+}
+
+// bounds(i, lo, hi) gives the box of item i, or false to leave it out
+template<typename F>
+void Grid::build(int count, F bounds) {
+	auto start = std::chrono::steady_clock::now();
+	min = glm::vec3(0.0f);
+	max = glm::vec3(0.0f);
+	resolution = glm::ivec3(0);
+	buckets = 0;
+	starts.clear();
+	entries.clear();
+
+	// cell size from the volume per cell, but never much smaller than the average item
+	int placed = 0;
+	float size = 0.0f;
+	for (int i=0;i<count;i++) {
+		glm::vec3 lo, hi;
+		if (!bounds(i, lo, hi)) {
+			continue;
+		}
+		min = placed == 0 ? lo : glm::min(min, lo);
+		max = placed == 0 ? hi : glm::max(max, hi);
+		size += glm::max(hi.x - lo.x, glm::max(hi.y - lo.y, hi.z - lo.z));
+		placed++;
+	}
+	if (placed == 0) {
+		buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return;
+	}
+	glm::vec3 extent = glm::max(max - min, glm::vec3(1e-3f));
+	cellSize = std::cbrt(extent.x * extent.y * extent.z / (placed * cellsPerItem));
+	cellSize = std::max(cellSize, size / placed * 0.5f);
+	cellSize = std::max(cellSize, glm::max(extent.x, glm::max(extent.y, extent.z)) / maxResolution);
+	resolution = glm::max(glm::ivec3(glm::ceil(extent / cellSize)), glm::ivec3(1));
+
+	buckets = 1;
+	while (buckets < 2 * placed) {
+		buckets *= 2;
+	}
+	starts.assign(buckets + 1, 0);
+
+	// items go in ascending order, so an item reaching a bucket through several cells is only
+	// listed once
+	auto overlapped = [&](int i, auto visit) {
+		glm::vec3 lo, hi;
+		if (!bounds(i, lo, hi)) {
+			return;
+		}
+		glm::ivec3 first = cell(lo);
+		glm::ivec3 end = cell(hi);
+		for (int z=first.z;z<=end.z;z++) {
+			for (int y=first.y;y<=end.y;y++) {
+				for (int x=first.x;x<=end.x;x++) {
+					int b = bucket(glm::ivec3(x, y, z));
+					if (last[b] != i) {
+						last[b] = i;
+						visit(b);
+					}
+				}
+			}
+		}
+	};
+	last.assign(buckets, -1);
+	for (int i=0;i<count;i++) {
+		overlapped(i, [&](int b) {
+			starts[b + 1]++;
+		});
+	}
+	for (int b=0;b<buckets;b++) {
+		starts[b + 1] += starts[b];
+	}
+	entries.resize(starts[buckets]);
+	cursors.assign(starts.begin(), starts.end() - 1);
+	last.assign(buckets, -1);
+	for (int i=0;i<count;i++) {
+		overlapped(i, [&](int b) {
+			entries[cursors[b]++] = i;
+		});
+	}
+	buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+glm::ivec3 Grid::cell(glm::vec3 position) {
+	return glm::clamp(glm::ivec3(glm::floor((position - min) / cellSize)), glm::ivec3(0), resolution - 1);
+}
+
+// matches gridBucket in shader.frag
+int Grid::bucket(glm::ivec3 cell) {
+	return (int)(((unsigned int)cell.x * 73856093u ^ (unsigned int)cell.y * 19349663u ^ (unsigned int)cell.z * 83492791u) & (unsigned int)(buckets - 1));
+}
+
+// bucket of the cell holding position, -1 outside the grid
+int Grid::find(glm::vec3 position) {
+	if (buckets == 0 || glm::any(glm::lessThan(position, min)) || glm::any(glm::greaterThan(position, min + glm::vec3(resolution) * cellSize))) {
+		return -1;
+	}
+	return bucket(cell(position));
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "objects.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// uniform grid over the spheres, or the lights with a radius, hashed into a table of buckets so
+// empty space costs nothing. rebuilt every frame by counting sort: count the items per bucket,
+// prefix sum, scatter. an item is listed once in the bucket of every cell its bounds overlap,
+// colliding cells share a bucket
+class Grid {
+public:
+	float cellsPerItem = 2.0f; // target cell count relative to the item count
+	int maxResolution = 512; // cells per axis
+
+	glm::vec3 min = glm::vec3(0.0f);
+	glm::vec3 max = glm::vec3(0.0f);
+	float cellSize = 1.0f;
+	glm::ivec3 resolution = glm::ivec3(0);
+	int buckets = 0; // power of two
+	std::vector<int> starts; // first entry of each bucket, buckets + 1
+	std::vector<int> entries; // item indices grouped by bucket, ascending within a bucket
+	std::vector<int> cursors;
+	std::vector<int> last; // item last counted per bucket
+	float buildTime = 0.0f; // ms, last build
+
+	void build(const std::vector<Sphere>& spheres);
+	void build(const std::vector<Light>& lights, const std::vector<glm::vec3>& sweeps = {});
+	template<typename F>
+	void build(int count, F bounds);
+	glm::ivec3 cell(glm::vec3 position);
+	int bucket(glm::ivec3 cell);
+	int find(glm::vec3 position);
+};
@@ -0,0 +1,72 @@
+#include "headless.hpp"
+
+#include <glad/gl.h>
+#include <iostream>
+
+#ifdef EUCLID_EGL
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+bool HeadlessContext::init() {
+	EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != nullptr) {
+		eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if (eglDisplay == EGL_NO_DISPLAY) {
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor)) {
+		std::cout << "headless: no egl display (" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+		return false;
+	}
+	eglBindAPI(EGL_OPENGL_API);
+
+	// surfaceless contexts need no config, otherwise take any config that can back a pbuffer
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	EGLint configAttributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+	EGLint numConfigs = 0;
+	eglChooseConfig(eglDisplay, configAttributes, &config, 1, &numConfigs);
+
+	// the shaders are #version 460
+	EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 6,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE};
+	EGLContext eglContext = eglCreateContext(eglDisplay, numConfigs > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+		std::cout << "headless: needs gl 4.6, no 4.6 core context (" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+		eglTerminate(eglDisplay);
+		return false;
+	}
+
+	display = eglDisplay;
+	context = eglContext;
+	gladLoadGL((GLADloadfunc)eglGetProcAddress);
+	std::cout << "headless: " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << std::endl;
+	return true;
+}
+
+void HeadlessContext::exit() {
+	if (display == nullptr) {
+		return;
+	}
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglTerminate(display);
+	display = nullptr;
+	context = nullptr;
+}
+#else
+bool HeadlessContext::init() {
+	std::cout << "headless: built without egl" << std::endl;
+	return false;
+}
+
+void HeadlessContext::exit() {
+
+}
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+// windowless gl context through egl on mesa's surfaceless platform (llvmpipe works),
+// falling back to the default display. all rendering goes to the renderer's fbo.
+class HeadlessContext {
+public:
+	void* display = nullptr;
+	void* context = nullptr;
+
+	bool init();
+	void exit();
+};
@@ -0,0 +1,123 @@
+#include "image.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static unsigned char toByte(float value) {
+	return (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+bool writePPM(std::string path, int width, int height, const std::vector<glm::vec4>& pixels) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	file << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> data(width * height * 3);
+	for (int i=0;i<width*height;i++) {
+		data[i*3 + 0] = toByte(pixels[i].r);
+		data[i*3 + 1] = toByte(pixels[i].g);
+		data[i*3 + 2] = toByte(pixels[i].b);
+	}
+	file.write((const char*)data.data(), data.size());
+	return (bool)file;
+}
+
+struct CrcTable {
+	unsigned int values[256];
+
+	CrcTable() {
+		for (unsigned int i=0;i<256;i++) {
+			unsigned int c = i;
+			for (int k=0;k<8;k++) {
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			values[i] = c;
+		}
+	}
+};
+
+static unsigned int crc32(const unsigned char* data, size_t size) {
+	static const CrcTable table;
+	unsigned int crc = 0xffffffffu;
+	for (size_t i=0;i<size;i++) {
+		crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void pushU32(std::vector<unsigned char>& out, unsigned int value) {
+	out.push_back((value >> 24) & 0xff);
+	out.push_back((value >> 16) & 0xff);
+	out.push_back((value >> 8) & 0xff);
+	out.push_back(value & 0xff);
+}
+
+static void pushChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+	pushU32(out, data.size());
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	pushU32(out, crc32(&out[start], out.size() - start));
+}
+
+// zlib stream of stored (uncompressed) deflate blocks, no compressor needed
+bool writePNG(std::string path, int width, int height, const std::vector<glm::vec4>& pixels) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	std::vector<unsigned char> raw;
+	raw.reserve((width * 3 + 1) * height);
+	for (int y=0;y<height;y++) {
+		raw.push_back(0);
+		for (int x=0;x<width;x++) {
+			glm::vec4 p = pixels[y*width + x];
+			raw.push_back(toByte(p.r));
+			raw.push_back(toByte(p.g));
+			raw.push_back(toByte(p.b));
+		}
+	}
+
+	std::vector<unsigned char> zlib = {0x78, 0x01};
+	size_t offset = 0;
+	do {
+		size_t size = std::min<size_t>(raw.size() - offset, 65535);
+		zlib.push_back(offset + size == raw.size() ? 1 : 0);
+		zlib.push_back(size & 0xff);
+		zlib.push_back((size >> 8) & 0xff);
+		zlib.push_back(~size & 0xff);
+		zlib.push_back((~size >> 8) & 0xff);
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+		offset += size;
+	} while (offset < raw.size());
+	unsigned int a = 1, b = 0;
+	for (size_t i=0;i<raw.size();i++) {
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	pushU32(zlib, (b << 16) | a);
+
+	std::vector<unsigned char> header;
+	pushU32(header, width);
+	pushU32(header, height);
+	header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit rgb
+
+	std::vector<unsigned char> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	pushChunk(out, "IHDR", header);
+	pushChunk(out, "IDAT", zlib);
+	pushChunk(out, "IEND", {});
+	file.write((const char*)out.data(), out.size());
+	return (bool)file;
+}
+
+bool writeImage(std::string path, int width, int height, const std::vector<glm::vec4>& pixels) {
+	if (path.size() >= 4 && path.substr(path.size() - 4) == ".ppm") {
+		return writePPM(path, width, height, pixels);
+	}
+	return writePNG(path, width, height, pixels);
+}
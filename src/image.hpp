@@ -0,0 +1,10 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// pixels are rgba, top row first, clamped to [0, 1] on write
+bool writePPM(std::string path, int width, int height, const std::vector<glm::vec4>& pixels);
+bool writePNG(std::string path, int width, int height, const std::vector<glm::vec4>& pixels);
+bool writeImage(std::string path, int width, int height, const std::vector<glm::vec4>& pixels);
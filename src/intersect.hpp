@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction;
+	glm::vec3 inverseDirection;
+
+	Ray(
+		glm::vec3 origin = glm::vec3(0.0f),
+		glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f)) {
+			this->origin = origin;
+			this->direction = direction;
+			this->inverseDirection = 1.0f / direction;
+	}
+};
+
+struct RayHit {
+	glm::vec3 position;
+	float distance;
+	glm::vec3 normal;
+	glm::vec4 color;
+	glm::vec4 material;
+	glm::vec4 tint;
+	bool final;
+};
+
+// the intersection kernels are shared with shader.frag
+namespace glsl {
+	using namespace glm;
+	#define KERNEL inline
+	#include "../res/kernels.glsl"
+	#undef KERNEL
+}
+
+using glsl::intersectAABB;
+using glsl::intersectBounds;
+using glsl::intersectPlane;
+using glsl::intersectSphere;
+using glsl::intersectQuad;
+using glsl::intersectBoxFace;
+using glsl::boxFaceNormal;
@@ -1,6 +1,7 @@
 #include "app.hpp"
 
-int main() {
+int main(int argc, char** argv) {
+	app.parse(argc, argv);
 	app.init();
 	app.loop();
 	app.exit();
@@ -7,6 +7,8 @@ struct Plane {
 	glm::vec4 normal; // x, y, z, offset
 	glm::vec4 color; // r, g, b, a
 	glm::vec4 material; // ambient, diffuse, specular, exponent
+	unsigned short colorIndex = 0; // into the scene palette (set by Scene::build and Scene::edit)
+	unsigned short materialIndex = 0;
 
 	Plane(
 		glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f), 
@@ -23,6 +25,8 @@ struct Sphere {
 	glm::vec4 position; // x, y, z, radius
 	glm::vec4 color; // r, g, b, a
 	glm::vec4 material; // ambient, diffuse, specular, exponent
+	unsigned short colorIndex = 0; // into the scene palette (set by Scene::build and Scene::edit)
+	unsigned short materialIndex = 0;
 	
 	glm::vec4 bounds[2]; // x, y, z, 0 (generated)
 
@@ -49,6 +53,8 @@ struct Quad {
 	glm::vec4 edges[2]; // x, y, z, 0
 	glm::vec4 color; // r, g, b, a
 	glm::vec4 material; // ambient, diffuse, specular, exponent
+	unsigned short colorIndex = 0; // into the scene palette (set by Scene::build and Scene::edit)
+	unsigned short materialIndex = 0;
 	
 	glm::vec4 normal; // x, y, z, offset (generated)
 	glm::vec4 bounds[2]; // x, y, z, 0 (generated)
@@ -81,6 +87,8 @@ struct Cube {
 	glm::vec4 edges[3]; // x, y, z, 0
 	glm::vec4 color; // r, g, b, a
 	glm::vec4 material; // ambient, diffuse, specular, exponent
+	unsigned short colorIndex = 0; // into the scene palette (set by Scene::build and Scene::edit)
+	unsigned short materialIndex = 0;
 
 	glm::vec4 normals[3]; // x, y, z, offset (generated)
 	glm::vec4 bounds[2]; // x, y, z, 0 (generated)
@@ -156,27 +164,147 @@ struct Light {
 	glm::vec4 position; // x, y, z, 0
 	glm::vec4 color; // r, g, b, a
 	glm::vec4 material; // ambient, diffuse, specular, exponent
+	glm::vec4 attenuation; // radius, constant, linear, quadratic, no falloff without a radius
 
 	Light(
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), 
 		glm::vec4 color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), 
-		glm::vec4 material = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)) {
+		glm::vec4 material = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f),
+		glm::vec4 attenuation = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f)) {
 			this->position = glm::vec4(position, 0.0f);
 			this->color = color;
 			this->material = material;
+			this->attenuation = attenuation;
+	}
+
+	// the falloff windowed to reach 0 at the radius, same as falloff in shader.frag
+	float falloff(float distance) const {
+		if (attenuation.x <= 0.0f) {
+			return 1.0f;
+		}
+		float x = distance / attenuation.x;
+		float window = glm::clamp(1.0f - x*x, 0.0f, 1.0f);
+		return window*window / (attenuation.y + attenuation.z*distance + attenuation.w*distance*distance);
+	}
+};
+
+// the part of a primitive the renderer uploads for the intersection loops, its surface is fetched
+// through the palette indices once for the nearest hit. planes and spheres upload their first vec4
+struct QuadShape {
+	glm::vec4 position;
+	glm::vec4 edges[2];
+	glm::vec4 normal;
+
+	QuadShape() {
+		this->position = glm::vec4(0.0f);
+		this->edges[0] = glm::vec4(0.0f);
+		this->edges[1] = glm::vec4(0.0f);
+		this->normal = glm::vec4(0.0f);
+	}
+
+	QuadShape(const Quad& quad) {
+		this->position = quad.position;
+		this->edges[0] = quad.edges[0];
+		this->edges[1] = quad.edges[1];
+		this->normal = quad.normal;
+	}
+};
+
+struct CubeShape {
+	glm::vec4 position;
+	glm::vec4 edges[3];
+	glm::vec4 normals[3];
+
+	CubeShape() {
+		this->position = glm::vec4(0.0f);
+		for (int i=0;i<3;i++) {
+			this->edges[i] = glm::vec4(0.0f);
+			this->normals[i] = glm::vec4(0.0f);
+		}
+	}
+
+	CubeShape(const Cube& cube) {
+		this->position = cube.position;
+		for (int i=0;i<3;i++) {
+			this->edges[i] = cube.edges[i];
+			this->normals[i] = cube.normals[i];
+		}
+	}
+};
+
+// a placed copy of a prefab. updaters move it through the translation column of the transform
+struct Instance {
+	glm::mat4 transform; // local to world
+	glm::mat4 inverse; // world to local (generated)
+	glm::vec4 bounds[2]; // x, y, z, 0 (generated)
+	glm::vec4 localBounds[2]; // x, y, z, 0 of the prefab (set by the scene)
+	glm::vec4 color; // r, g, b, a, replaces the prefab colors unless a is negative
+	int prefab;
+	int root; // bvh root of the prefab in the scene's prefab nodes (set by the scene)
+	int pad[2];
+
+	Instance(
+		int prefab = 0,
+		glm::mat4 transform = glm::mat4(1.0f),
+		glm::vec4 color = glm::vec4(-1.0f)) {
+			this->transform = transform;
+			this->inverse = glm::inverse(transform);
+			this->color = color;
+			this->prefab = prefab;
+			this->root = 0;
+			this->localBounds[0] = glm::vec4(0.0f);
+			this->localBounds[1] = glm::vec4(0.0f);
+			this->bounds[0] = glm::vec4(0.0f);
+			this->bounds[1] = glm::vec4(0.0f);
+	}
+
+	void generate() {
+		inverse = glm::inverse(transform);
+		// world box around the eight transformed corners of the prefab box
+		glm::vec3 lo = glm::vec3(transform * glm::vec4(glm::vec3(localBounds[0]), 1.0f));
+		glm::vec3 hi = lo;
+		for (int i=1;i<8;i++) {
+			glm::vec3 corner = glm::vec3(i & 1 ? localBounds[1].x : localBounds[0].x, i & 2 ? localBounds[1].y : localBounds[0].y, i & 4 ? localBounds[1].z : localBounds[0].z);
+			glm::vec3 p = glm::vec3(transform * glm::vec4(corner, 1.0f));
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		bounds[0] = glm::vec4(lo, 0.0f);
+		bounds[1] = glm::vec4(hi, 0.0f);
 	}
 };
 
+// an updater's motion as the animate compute pass evaluates it, see Scene::sweep
+struct Animation {
+	glm::vec4 origin; // x, y, z, kind: 0 bob, 1 circle
+	glm::vec4 u; // bob axis, circle x axis
+	glm::vec4 v; // circle y axis
+	glm::vec4 parameters; // bob: min, max, speed, offset. circle: radius, speed, offset, 0
+	glm::ivec4 target; // scene array, index
+};
+
 class Updater {
 public:
+	glm::vec4* position; // the object's position, first member of every primitive
+
 	virtual void update(float time) {
 
 	}
+
+	// box the position stays in at any time
+	virtual void extent(glm::vec3& lo, glm::vec3& hi) {
+		lo = glm::vec3(*position);
+		hi = glm::vec3(*position);
+	}
+
+	// false when the motion has no closed form the compute pass knows
+	virtual bool animate(Animation& animation) {
+		return false;
+	}
 };
 
 class BobUpdater : public Updater {
 public:
-	glm::vec4* position;
 	glm::vec3 origin;
 	glm::vec3 axis;
 	float min;
@@ -204,11 +332,23 @@ public:
 		float factor = min + 0.5f*(max - min)*(1.0f + sin(speed*time + offset));
 		*position = glm::vec4(origin + glm::vec3(axis * factor), position->w);
 	}
+
+	virtual void extent(glm::vec3& lo, glm::vec3& hi) {
+		lo = glm::min(origin + axis * min, origin + axis * max);
+		hi = glm::max(origin + axis * min, origin + axis * max);
+	}
+
+	virtual bool animate(Animation& animation) {
+		animation.origin = glm::vec4(origin, 0.0f);
+		animation.u = glm::vec4(axis, 0.0f);
+		animation.v = glm::vec4(0.0f);
+		animation.parameters = glm::vec4(min, max, speed, offset);
+		return true;
+	}
 };
 
 class CircleUpdater : public Updater {
 public:
-	glm::vec4* position;
 	glm::vec3 origin;
 	glm::vec3 axis;
 	float radius;
@@ -230,11 +370,36 @@ public:
 	}
 
 	virtual void update(float time) {
-		glm::vec3 axisX = glm::cross(axis, glm::vec3(1.0f, 0.0f, 0.0f));
+		glm::vec3 axisX, axisY;
+		axes(axisX, axisY);
+		*position = glm::vec4(origin + axisX * (float)sin(speed * time + offset) * radius + axisY * (float)cos(speed * time + offset) * radius, position->w);
+	}
+
+	virtual void extent(glm::vec3& lo, glm::vec3& hi) {
+		glm::vec3 axisX, axisY;
+		axes(axisX, axisY);
+		glm::vec3 reach = (glm::abs(axisX) + glm::abs(axisY)) * radius;
+		lo = origin - reach;
+		hi = origin + reach;
+	}
+
+	virtual bool animate(Animation& animation) {
+		glm::vec3 axisX, axisY;
+		axes(axisX, axisY);
+		animation.origin = glm::vec4(origin, 1.0f);
+		animation.u = glm::vec4(axisX, 0.0f);
+		animation.v = glm::vec4(axisY, 0.0f);
+		animation.parameters = glm::vec4(radius, speed, offset, 0.0f);
+		return true;
+	}
+
+	// normalized, spanning the circle's plane
+	void axes(glm::vec3& axisX, glm::vec3& axisY) {
+		axisX = glm::cross(axis, glm::vec3(1.0f, 0.0f, 0.0f));
 		if (glm::length(axisX) < 0.001f) {
 			axisX = glm::cross(axis, glm::vec3(0.0f, 0.0f, 1.0f));
 		}
-		glm::vec3 axisY = glm::cross(axis, axisX);
-		*position = glm::vec4(origin + glm::normalize(axisX) * (float)sin(speed * time + offset) * radius + glm::normalize(axisY) * (float)cos(speed * time + offset) * radius, position->w);
+		axisY = glm::normalize(glm::cross(axis, axisX));
+		axisX = glm::normalize(axisX);
 	}
 };
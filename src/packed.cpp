@@ -0,0 +1,65 @@
+#include "packed.hpp"
+
+#include "objects.hpp"
+#include "simd.hpp"
+
+#include <limits>
+#include <vector>
+
+static int padded(int count) {
+	return (count + 7) / 8 * 8;
+}
+
+static void resize(int count, std::initializer_list<std::vector<float>*> arrays) {
+	for (std::vector<float>* array : arrays) {
+		array->assign(padded(count), std::numeric_limits<float>::quiet_NaN());
+	}
+}
+
+static BoxLanes boxLanes(std::vector<float>& minX, std::vector<float>& minY, std::vector<float>& minZ, std::vector<float>& maxX, std::vector<float>& maxY, std::vector<float>& maxZ) {
+	return {minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data(), (int)minX.size()};
+}
+
+void PackedScene::pack(const std::vector<Sphere>& spheres, const std::vector<Quad>& quads, const std::vector<Cube>& cubes) {
+	resize(spheres.size(), {&sphereX, &sphereY, &sphereZ, &sphereR});
+	for (int i=0;i<spheres.size();i++) {
+		sphereX[i] = spheres[i].position.x;
+		sphereY[i] = spheres[i].position.y;
+		sphereZ[i] = spheres[i].position.z;
+		sphereR[i] = spheres[i].position.w;
+	}
+	this->spheres = {sphereX.data(), sphereY.data(), sphereZ.data(), sphereR.data(), (int)sphereX.size()};
+
+	resize(quads.size(), {&quadPX, &quadPY, &quadPZ, &quadAX, &quadAY, &quadAZ, &quadBX, &quadBY, &quadBZ, &quadNX, &quadNY, &quadNZ, &quadNW});
+	resize(quads.size(), {&quadMinX, &quadMinY, &quadMinZ, &quadMaxX, &quadMaxY, &quadMaxZ});
+	for (int i=0;i<quads.size();i++) {
+		const Quad& quad = quads[i];
+		quadPX[i] = quad.position.x; quadPY[i] = quad.position.y; quadPZ[i] = quad.position.z;
+		quadAX[i] = quad.edges[0].x; quadAY[i] = quad.edges[0].y; quadAZ[i] = quad.edges[0].z;
+		quadBX[i] = quad.edges[1].x; quadBY[i] = quad.edges[1].y; quadBZ[i] = quad.edges[1].z;
+		quadNX[i] = quad.normal.x; quadNY[i] = quad.normal.y; quadNZ[i] = quad.normal.z; quadNW[i] = quad.normal.w;
+		quadMinX[i] = quad.bounds[0].x; quadMinY[i] = quad.bounds[0].y; quadMinZ[i] = quad.bounds[0].z;
+		quadMaxX[i] = quad.bounds[1].x; quadMaxY[i] = quad.bounds[1].y; quadMaxZ[i] = quad.bounds[1].z;
+	}
+	this->quads = {
+		quadPX.data(), quadPY.data(), quadPZ.data(),
+		quadAX.data(), quadAY.data(), quadAZ.data(),
+		quadBX.data(), quadBY.data(), quadBZ.data(),
+		quadNX.data(), quadNY.data(), quadNZ.data(), quadNW.data(),
+		boxLanes(quadMinX, quadMinY, quadMinZ, quadMaxX, quadMaxY, quadMaxZ),
+		(int)quadPX.size()};
+
+	resize(cubes.size(), {&cubeMinX, &cubeMinY, &cubeMinZ, &cubeMaxX, &cubeMaxY, &cubeMaxZ});
+	for (int i=0;i<cubes.size();i++) {
+		cubeMinX[i] = cubes[i].bounds[0].x; cubeMinY[i] = cubes[i].bounds[0].y; cubeMinZ[i] = cubes[i].bounds[0].z;
+		cubeMaxX[i] = cubes[i].bounds[1].x; cubeMaxY[i] = cubes[i].bounds[1].y; cubeMaxZ[i] = cubes[i].bounds[1].z;
+	}
+	this->cubes = boxLanes(cubeMinX, cubeMinY, cubeMinZ, cubeMaxX, cubeMaxY, cubeMaxZ);
+}
+
+RayLane toLane(const Ray& ray) {
+	return {
+		ray.origin.x, ray.origin.y, ray.origin.z,
+		ray.direction.x, ray.direction.y, ray.direction.z,
+		ray.inverseDirection.x, ray.inverseDirection.y, ray.inverseDirection.z};
+}
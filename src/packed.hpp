@@ -0,0 +1,27 @@
+#pragma once
+
+#include "objects.hpp"
+#include "intersect.hpp"
+#include "simd.hpp"
+
+#include <vector>
+
+// structure-of-arrays mirror of the scene's bounded primitives, rebuilt after every scene update
+class PackedScene {
+public:
+	std::vector<float> sphereX, sphereY, sphereZ, sphereR;
+	std::vector<float> quadPX, quadPY, quadPZ;
+	std::vector<float> quadAX, quadAY, quadAZ;
+	std::vector<float> quadBX, quadBY, quadBZ;
+	std::vector<float> quadNX, quadNY, quadNZ, quadNW;
+	std::vector<float> quadMinX, quadMinY, quadMinZ, quadMaxX, quadMaxY, quadMaxZ;
+	std::vector<float> cubeMinX, cubeMinY, cubeMinZ, cubeMaxX, cubeMaxY, cubeMaxZ;
+
+	SphereLanes spheres;
+	QuadLanes quads;
+	BoxLanes cubes;
+
+	void pack(const std::vector<Sphere>& spheres, const std::vector<Quad>& quads, const std::vector<Cube>& cubes);
+};
+
+RayLane toLane(const Ray& ray);
@@ -2,12 +2,16 @@
 
 #include "app.hpp"
 #include "scene.hpp"
+#include "image.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -16,6 +20,7 @@
 
 void Renderer::init() {
 	shader = compileShader("shader");
+	animateShader = compileCompute("animate");
 	generateBuffers();
 
 	vertices = {
@@ -26,6 +31,9 @@ void Renderer::init() {
 		-1.0f, -1.0f,
 		-1.0f,  1.0f,
 	};
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices.front(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	updateBuffers();
 }
@@ -34,11 +42,38 @@ void Renderer::update() {
 	if (animation) {
 		time += app.deltaTime;
 	}
+	app.scene.accelerator = accelerator;
 	app.scene.update(time);
-	updateBuffers();
+	// the culled list and the arrays derived from the scene only change with it, the view or the
+	// accelerator, whose structures the scene only keeps current while they are in use
+	float aspect = (float)app.height / (float)app.width;
+	if (app.scene.revision != culledRevision || app.camera.view != culledView || aspect != culledAspect || accelerator != culledAccelerator) {
+		cull();
+		updateBuffers();
+	} else {
+		uploadedBytes = 0;
+		stallTime = 0.0f;
+	}
+	animate();
+}
+
+// moves the objects of the scene's gpu animations to where their updaters put them at time
+void Renderer::animate() {
+	if (app.scene.animations.empty()) {
+		return;
+	}
+	glUseProgram(animateShader);
+	glUniform1f(0, time);
+	glDispatchCompute((app.scene.animations.size() + 63) / 64, 1, 1);
+	// the draw reads the moved objects, and the next upload may copy over them
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	glUseProgram(0);
 }
 
 void Renderer::draw() {
+	if (fbo != 0) {
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	}
 	glUseProgram(shader);
 	glBindVertexArray(vao);
 
@@ -52,12 +87,19 @@ void Renderer::draw() {
 	glUniform1i(7, lighting);
 	glUniform1i(8, shadows);
 	glUniform4fv(9, 1, glm::value_ptr(app.scene.skyColor));
-	glUniform1i(10, app.scene.planes.size());
-	glUniform1i(11, app.scene.spheres.size());
-	glUniform1i(12, app.scene.quads.size());
-	glUniform1i(13, app.scene.cubes.size());
-	glUniform1i(14, app.scene.volumes.size());
-	glUniform1i(15, app.scene.lights.size());
+	glUniform1i(16, app.scene.bvh.nodes.size());
+	glUniform1i(17, accelerator);
+	glUniform1i(18, app.scene.instances.size());
+	glUniform1i(19, app.scene.bvh.nodes.size() + app.scene.tlas.nodes.size());
+	glUniform1i(20, app.scene.bvh.wideNodes.size());
+	glUniform4f(21, app.scene.grid.min.x, app.scene.grid.min.y, app.scene.grid.min.z, app.scene.grid.cellSize);
+	glUniform4i(22, app.scene.grid.resolution.x, app.scene.grid.resolution.y, app.scene.grid.resolution.z, app.scene.grid.buckets);
+	glUniform2i(23, visibleStart, visible.size());
+	glUniform4f(24, app.scene.lightGrid.min.x, app.scene.lightGrid.min.y, app.scene.lightGrid.min.z, app.scene.lightGrid.cellSize);
+	glUniform4i(25, app.scene.lightGrid.resolution.x, app.scene.lightGrid.resolution.y, app.scene.lightGrid.resolution.z, app.scene.lightGrid.buckets);
+	glUniform2i(26, lightListStart, app.scene.globalLights.size());
+	glUniform1iv(27, 6, surfaceStarts);
+	glUniform2i(33, paletteStarts[0], paletteStarts[1]);
 
 	glDrawArrays(GL_TRIANGLES, 0, vertices.size() / 2);
 
@@ -65,6 +107,74 @@ void Renderer::draw() {
 	glUseProgram(0);
 }
 
+void Renderer::initTarget(int width, int height) {
+	targetWidth = width;
+	targetHeight = height;
+	framebuffer.assign(width * height, glm::vec4(0.0f));
+
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(1, &colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "offscreen framebuffer incomplete" << std::endl;
+	}
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenBuffers(2, pbos);
+	for (int i=0;i<2;i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// returns whether the previous frame was collected into framebuffer
+bool Renderer::read() {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[readIndex]);
+	glReadPixels(0, 0, targetWidth, targetHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fences[readIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	readIndex = (readIndex + 1) % 2;
+	return collect(readIndex);
+}
+
+bool Renderer::collect(int index) {
+	if (fences[index] == nullptr) {
+		return false;
+	}
+	glClientWaitSync((GLsync)fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	glDeleteSync((GLsync)fences[index]);
+	fences[index] = nullptr;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[index]);
+	unsigned char* pixels = (unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, targetWidth * targetHeight * 4, GL_MAP_READ_BIT);
+	if (pixels != nullptr) {
+		for (int y=0;y<targetHeight;y++) {
+			for (int x=0;x<targetWidth;x++) {
+				unsigned char* p = pixels + ((targetHeight - 1 - y)*targetWidth + x) * 4;
+				framebuffer[y*targetWidth + x] = glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return true;
+}
+
+void Renderer::finish() {
+	collect(readIndex);
+	collect((readIndex + 1) % 2);
+}
+
+bool Renderer::save(std::string path) {
+	return writeImage(path, targetWidth, targetHeight, framebuffer);
+}
+
 void Renderer::generateBuffers() {
 	glGenVertexArrays(1, &vao);
 	glGenBuffers(1, &vbo);
@@ -74,34 +184,393 @@ void Renderer::generateBuffers() {
 	glEnableVertexAttribArray(0);
 	glBindVertexArray(0);
 
-	glGenBuffers(1, &uboObjects);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 0, uboObjects);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	initStorage(ssboPlanes, 9);
+	initStorage(ssboSpheres, 10);
+	initStorage(ssboQuads, 11);
+	initStorage(ssboCubes, 12);
+	initStorage(ssboVolumes, 13);
+	initStorage(ssboLights, 14);
+	initStorage(ssboSurfaces, 0);
+	glGenBuffers(1, &ssboEmpty);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboEmpty);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 0, NULL, GL_STATIC_DRAW);
+
+	initStorage(ssboNodes, 1);
+	initStorage(ssboReferences, 2);
+	initStorage(ssboInstances, 3);
+	initStorage(ssboPrefabSpheres, 4);
+	initStorage(ssboPrefabQuads, 5);
+	initStorage(ssboPrefabCubes, 6);
+	initStorage(ssboWideNodes, 7);
+	initStorage(ssboGrid, 8);
+	initStorage(ssboAnimations, 15);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 void Renderer::updateBuffers() {
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices.front(), GL_DYNAMIC_DRAW);
-	glBindVertexArray(0);
+	Scene& scene = app.scene;
+	nodes.clear();
+	references.clear();
+	appendNodes(scene.bvh.nodes, scene.bvh.references);
+	appendNodes(scene.tlas.nodes, scene.tlas.references);
+	appendNodes(scene.prefabNodes, scene.prefabReferences);
+	visibleStart = references.size();
+	references.insert(references.end(), visible.begin(), visible.end());
+	grid.assign(scene.grid.starts.begin(), scene.grid.starts.end());
+	grid.insert(grid.end(), scene.grid.entries.begin(), scene.grid.entries.end());
+	lightListStart = grid.size();
+	grid.insert(grid.end(), scene.globalLights.begin(), scene.globalLights.end());
+	grid.insert(grid.end(), scene.lightGrid.starts.begin(), scene.lightGrid.starts.end());
+	grid.insert(grid.end(), scene.lightGrid.entries.begin(), scene.lightGrid.entries.end());
+
+	prefabSphereShapes.clear();
+	for (int i=0;i<scene.prefabSpheres.size();i++) {
+		prefabSphereShapes.push_back(scene.prefabSpheres[i].position);
+	}
+	prefabQuadShapes.assign(scene.prefabQuads.begin(), scene.prefabQuads.end());
+	prefabCubeShapes.assign(scene.prefabCubes.begin(), scene.prefabCubes.end());
+	// the palette and its indices only change with a build or an edit
+	bool surfacesChanged = scene.surfaceRevision != surfaceRevision;
+	if (surfacesChanged) {
+		surfaces.clear();
+		for (int i=0;i<scene.planes.size();i++) {
+			surfaces.push_back((unsigned int)scene.planes[i].materialIndex << 16 | scene.planes[i].colorIndex);
+		}
+		int* start = surfaceStarts;
+		auto appendSurfaces = [&](const auto& objects) {
+			*start++ = surfaces.size();
+			for (int i=0;i<objects.size();i++) {
+				surfaces.push_back((unsigned int)objects[i].materialIndex << 16 | objects[i].colorIndex);
+			}
+		};
+		appendSurfaces(scene.spheres);
+		appendSurfaces(scene.quads);
+		appendSurfaces(scene.cubes);
+		appendSurfaces(scene.prefabSpheres);
+		appendSurfaces(scene.prefabQuads);
+		appendSurfaces(scene.prefabCubes);
+		// the palette after them, from the next 16 byte element
+		surfaces.resize((surfaces.size() + 3) / 4 * 4, 0);
+		auto appendEntries = [&](const std::vector<glm::vec4>& entries, int& start) {
+			start = surfaces.size() / 4;
+			surfaces.resize(surfaces.size() + entries.size()*4);
+			std::memcpy(&surfaces[start*4], entries.data(), entries.size()*sizeof(glm::vec4));
+		};
+		appendEntries(scene.palette.colors, paletteStarts[0]);
+		appendEntries(scene.palette.materials, paletteStarts[1]);
+	}
+
+	int size = scene.planes.size()*sizeof(glm::vec4) + scene.spheres.size()*sizeof(glm::vec4) + scene.quads.size()*sizeof(QuadShape);
+	size += scene.cubes.size()*sizeof(CubeShape) + scene.volumes.size()*sizeof(Volume) + scene.lights.size()*sizeof(Light);
+	size += surfaces.size()*sizeof(unsigned int);
+	size += nodes.size()*sizeof(BVHNode) + references.size()*sizeof(int) + scene.instances.size()*sizeof(Instance);
+	size += prefabSphereShapes.size()*sizeof(glm::vec4) + prefabQuadShapes.size()*sizeof(QuadShape) + prefabCubeShapes.size()*sizeof(CubeShape);
+	size += scene.bvh.wideNodes.size()*sizeof(WideNode) + grid.size()*sizeof(int) + scene.animations.size()*sizeof(Animation);
+
+	// the scene arrays send the objects marked dirty, the arrays rebuilt from them every update send
+	// what differs from their last upload
+	beginUpload(size);
+	upload(ssboPlanes, scene.planes, planeShapes, scene.dirtyPlanes);
+	upload(ssboSpheres, scene.spheres, sphereShapes, scene.dirtySpheres);
+	upload(ssboQuads, scene.quads, quadShapes, scene.dirtyQuads);
+	upload(ssboCubes, scene.cubes, cubeShapes, scene.dirtyCubes);
+	upload(ssboVolumes, scene.volumes, scene.dirtyVolumes);
+	upload(ssboLights, scene.lights, scene.dirtyLights);
+	if (surfacesChanged) {
+		uploadChanged(ssboSurfaces, surfaces.data(), surfaces.size()*sizeof(unsigned int), sizeof(unsigned int));
+		surfaceRevision = scene.surfaceRevision;
+	}
+	uploadChanged(ssboNodes, nodes.data(), nodes.size()*sizeof(BVHNode), sizeof(BVHNode));
+	uploadChanged(ssboReferences, references.data(), references.size()*sizeof(int), sizeof(int));
+	uploadChanged(ssboInstances, scene.instances.data(), scene.instances.size()*sizeof(Instance), sizeof(Instance));
+	uploadChanged(ssboPrefabSpheres, prefabSphereShapes.data(), prefabSphereShapes.size()*sizeof(glm::vec4), sizeof(glm::vec4));
+	uploadChanged(ssboPrefabQuads, prefabQuadShapes.data(), prefabQuadShapes.size()*sizeof(QuadShape), sizeof(QuadShape));
+	uploadChanged(ssboPrefabCubes, prefabCubeShapes.data(), prefabCubeShapes.size()*sizeof(CubeShape), sizeof(CubeShape));
+	uploadChanged(ssboWideNodes, scene.bvh.wideNodes.data(), scene.bvh.wideNodes.size()*sizeof(WideNode), sizeof(WideNode));
+	uploadChanged(ssboGrid, grid.data(), grid.size()*sizeof(int), sizeof(int));
+	uploadChanged(ssboAnimations, scene.animations.data(), scene.animations.size()*sizeof(Animation), sizeof(Animation));
+	endUpload();
+}
 
-	int bufferSize = MAX_OBJECTS*sizeof(Plane)+MAX_OBJECTS*sizeof(Sphere)+MAX_OBJECTS*sizeof(Quad)+MAX_OBJECTS*sizeof(Cube)+MAX_OBJECTS*sizeof(Volume)+MAX_OBJECTS*sizeof(Light);
-	int offsetPlanes = 0;
-	int offsetSpheres = offsetPlanes + MAX_OBJECTS*sizeof(Plane);
-	int offsetQuads = offsetSpheres + MAX_OBJECTS*sizeof(Sphere);
-	int offsetCubes = offsetQuads + MAX_OBJECTS*sizeof(Quad);
-	int offsetVolumes = offsetCubes + MAX_OBJECTS*sizeof(Cube);
-	int offsetLights = offsetVolumes + MAX_OBJECTS*sizeof(Volume);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, uboObjects);
-	glBufferData(GL_UNIFORM_BUFFER, bufferSize, NULL, GL_DYNAMIC_DRAW);
-	glBufferSubData(GL_UNIFORM_BUFFER, offsetPlanes, app.scene.planes.size()*sizeof(Plane), &app.scene.planes.front());
-	glBufferSubData(GL_UNIFORM_BUFFER, offsetSpheres, app.scene.spheres.size()*sizeof(Sphere), &app.scene.spheres.front());
-	glBufferSubData(GL_UNIFORM_BUFFER, offsetQuads, app.scene.quads.size()*sizeof(Quad), &app.scene.quads.front());
-	glBufferSubData(GL_UNIFORM_BUFFER, offsetCubes, app.scene.cubes.size()*sizeof(Cube), &app.scene.cubes.front());
-	glBufferSubData(GL_UNIFORM_BUFFER, offsetVolumes, app.scene.volumes.size()*sizeof(Volume), &app.scene.volumes.front());
-	glBufferSubData(GL_UNIFORM_BUFFER, offsetLights, app.scene.lights.size()*sizeof(Light), &app.scene.lights.front());
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+void Renderer::initStorage(StorageBuffer& buffer, int binding) {
+	glGenBuffers(1, &buffer.id);
+	buffer.binding = binding;
+	buffer.capacity = 0;
+}
+
+// waits until the gpu is done copying out of this frame's ring region, first regrowing the ring
+// when a region can't hold size bytes
+void Renderer::beginUpload(int size) {
+	uploadedBytes = 0;
+	stallTime = 0.0f;
+	auto start = std::chrono::steady_clock::now();
+	if (size > ringSize) {
+		for (int i=0;i<RING_REGIONS;i++) {
+			if (ringFences[i] != nullptr) {
+				glClientWaitSync((GLsync)ringFences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+				glDeleteSync((GLsync)ringFences[i]);
+				ringFences[i] = nullptr;
+			}
+		}
+		if (ring != 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, ring);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			glDeleteBuffers(1, &ring);
+		}
+		ringSize = std::max(size, ringSize * 2);
+		ringRegion = 0;
+		glGenBuffers(1, &ring);
+		glBindBuffer(GL_COPY_READ_BUFFER, ring);
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_READ_BUFFER, ringSize * RING_REGIONS, NULL, flags);
+		ringData = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, ringSize * RING_REGIONS, flags);
+	} else if (ringFences[ringRegion] != nullptr) {
+		glClientWaitSync((GLsync)ringFences[ringRegion], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync((GLsync)ringFences[ringRegion]);
+		ringFences[ringRegion] = nullptr;
+	}
+	stallTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	ringOffset = 0;
+	glBindBuffer(GL_COPY_READ_BUFFER, ring);
+}
+
+// binds the first size bytes of the buffer, doubling its capacity when they don't fit. only the live
+// range is bound, so the shader reads the element count from the array's length(). returns false when
+// the buffer was reallocated and lost its contents
+bool Renderer::reserve(StorageBuffer& buffer, int size) {
+	bool kept = true;
+	if (size > buffer.capacity) {
+		buffer.capacity = std::max(size, buffer.capacity * 2);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id);
+		glBufferData(GL_COPY_WRITE_BUFFER, buffer.capacity, NULL, GL_DYNAMIC_COPY);
+		kept = false;
+	}
+	buffer.size = size;
+	if (size == 0) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, buffer.binding, ssboEmpty);
+	} else {
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, buffer.binding, buffer.id, 0, size);
+	}
+	return kept;
+}
+
+// copies size bytes into the ring and from there to offset in the buffer
+void Renderer::stage(StorageBuffer& buffer, const void* data, int offset, int size) {
+	int start = ringRegion * ringSize + ringOffset;
+	std::memcpy(ringData + start, data, size);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, start, offset, size);
+	ringOffset += size;
+	uploadedBytes += size;
+}
+
+// sends the runs of consecutive dirty objects, or the whole array after a load, a resize or a
+// reallocation
+template<typename T>
+void Renderer::upload(StorageBuffer& buffer, const std::vector<T>& objects, Dirty& dirty) {
+	int size = objects.size() * sizeof(T);
+	bool whole = dirty.all || size != buffer.size;
+	if (!reserve(buffer, size) || whole) {
+		if (size > 0) {
+			stage(buffer, objects.data(), 0, size);
+		}
+		dirty.clear();
+		return;
+	}
+	std::vector<int>& indices = dirty.indices;
+	std::sort(indices.begin(), indices.end());
+	for (int i=0;i<indices.size();) {
+		int first = indices[i];
+		int count = 1;
+		while (i + count < indices.size() && indices[i + count] == first + count) {
+			count++;
+		}
+		stage(buffer, &objects[first], first * sizeof(T), count * sizeof(T));
+		i += count;
+	}
+	dirty.clear();
+}
+
+static glm::vec4 shape(const Plane& plane) {
+	return plane.normal;
+}
+
+static glm::vec4 shape(const Sphere& sphere) {
+	return sphere.position;
+}
+
+static QuadShape shape(const Quad& quad) {
+	return QuadShape(quad);
+}
+
+static CubeShape shape(const Cube& cube) {
+	return CubeShape(cube);
+}
+
+// the same for the arrays that go up as shapes, which are regenerated for the objects sent
+template<typename T, typename S>
+void Renderer::upload(StorageBuffer& buffer, const std::vector<T>& objects, std::vector<S>& shapes, Dirty& dirty) {
+	int size = objects.size() * sizeof(S);
+	bool whole = dirty.all || size != buffer.size;
+	if (!reserve(buffer, size) || whole) {
+		shapes.clear();
+		for (int i=0;i<objects.size();i++) {
+			shapes.push_back(shape(objects[i]));
+		}
+		if (size > 0) {
+			stage(buffer, shapes.data(), 0, size);
+		}
+		dirty.clear();
+		return;
+	}
+	std::vector<int>& indices = dirty.indices;
+	std::sort(indices.begin(), indices.end());
+	for (int i=0;i<indices.size();) {
+		int first = indices[i];
+		int count = 1;
+		while (i + count < indices.size() && indices[i + count] == first + count) {
+			count++;
+		}
+		for (int j=first;j<first+count;j++) {
+			shapes[j] = shape(objects[j]);
+		}
+		stage(buffer, &shapes[first], first * sizeof(S), count * sizeof(S));
+		i += count;
+	}
+	dirty.clear();
+}
+
+// sends the runs of elements that differ from the last upload, for the arrays rebuilt every update
+void Renderer::uploadChanged(StorageBuffer& buffer, const void* data, int size, int stride) {
+	const char* bytes = (const char*)data;
+	bool whole = size != buffer.size;
+	if (!reserve(buffer, size) || whole) {
+		if (size > 0) {
+			stage(buffer, data, 0, size);
+		}
+		buffer.shadow.assign(bytes, bytes + size);
+		return;
+	}
+	char* shadow = buffer.shadow.data();
+	for (int i=0;i<size;) {
+		if (std::memcmp(bytes + i, shadow + i, stride) == 0) {
+			i += stride;
+			continue;
+		}
+		int start = i;
+		while (i < size && std::memcmp(bytes + i, shadow + i, stride) != 0) {
+			i += stride;
+		}
+		stage(buffer, bytes + start, start, i - start);
+		std::memcpy(shadow + start, bytes + start, i - start);
+	}
+}
+
+void Renderer::endUpload() {
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (ring != 0) {
+		ringFences[ringRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		ringRegion = (ringRegion + 1) % RING_REGIONS;
+	}
+}
+
+// primary rays in the linear and grid modes only test the primitives whose bounds touch the view
+// pyramid, secondary rays keep the full set
+void Renderer::cull() {
+	Scene& scene = app.scene;
+	culledRevision = scene.revision;
+	culledAccelerator = accelerator;
+	culledView = app.camera.view;
+	culledAspect = (float)app.height / (float)app.width;
+	glm::vec4 planes[4];
+	app.camera.frustum(culledAspect, planes);
+	auto inside = [&](const glm::vec4 bounds[2]) {
+		glm::vec3 lo = glm::min(glm::vec3(bounds[0]), glm::vec3(bounds[1]));
+		glm::vec3 hi = glm::max(glm::vec3(bounds[0]), glm::vec3(bounds[1]));
+		for (int i=0;i<4;i++) {
+			glm::vec3 p = glm::vec3(planes[i].x > 0.0f ? hi.x : lo.x, planes[i].y > 0.0f ? hi.y : lo.y, planes[i].z > 0.0f ? hi.z : lo.z);
+			if (glm::dot(glm::vec3(planes[i]), p) + planes[i].w < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	visible.clear();
+	for (int i=0;i<scene.spheres.size();i++) {
+		if (inside(scene.spheres[i].bounds)) {
+			visible.push_back(BVH::SPHERE << BVH::TYPE_SHIFT | i);
+		}
+	}
+	for (int i=0;i<scene.quads.size();i++) {
+		if (inside(scene.quads[i].bounds)) {
+			visible.push_back(BVH::QUAD << BVH::TYPE_SHIFT | i);
+		}
+	}
+	for (int i=0;i<scene.cubes.size();i++) {
+		if (inside(scene.cubes[i].bounds)) {
+			visible.push_back(BVH::CUBE << BVH::TYPE_SHIFT | i);
+		}
+	}
+	int total = scene.spheres.size() + scene.quads.size() + scene.cubes.size();
+	culled = total == 0 ? 0.0f : 1.0f - (float)visible.size() / total;
+}
+
+// appends a bvh to the shader's node and reference arrays, offsetting its child and reference indices
+void Renderer::appendNodes(const std::vector<BVHNode>& nodes, const std::vector<int>& references) {
+	int nodeOffset = this->nodes.size();
+	int referenceOffset = this->references.size();
+	for (int i=0;i<nodes.size();i++) {
+		BVHNode node = nodes[i];
+		node.start += node.count > 0 ? referenceOffset : nodeOffset;
+		this->nodes.push_back(node);
+	}
+	this->references.insert(this->references.end(), references.begin(), references.end());
+}
+
+// reads res/<name> and splices in the files named by #include "..." lines, which glsl has no notion of
+std::string Renderer::loadSource(std::string name) {
+	std::ifstream file("res/" + name);
+	std::string source;
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.rfind("#include \"", 0) == 0) {
+			std::string include = line.substr(10, line.find('"', 10) - 10);
+			source += loadSource(include);
+		} else {
+			source += line + "\n";
+		}
+	}
+	return source;
+}
+
+unsigned int Renderer::compileCompute(std::string name) {
+	const char *compSource;
+	std::string compString = loadSource(name + ".comp");
+	compSource = compString.c_str();
+	unsigned int compShader;
+	compShader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(compShader, 1, &compSource, NULL);
+	glCompileShader(compShader);
+
+	int success;
+	success = 0;
+	glGetShaderiv(compShader, GL_COMPILE_STATUS, &success);
+	if (success == 0) {
+		int logSize = 0;
+		glGetShaderiv(compShader, GL_INFO_LOG_LENGTH, &logSize);
+		std::vector<char> errorLog(logSize);
+		glGetShaderInfoLog(compShader, logSize, &logSize, &errorLog.front());
+		std::cout << errorLog.data() << std::endl;
+	}
+
+	unsigned int shader = glCreateProgram();
+	glAttachShader(shader, compShader);
+	glLinkProgram(shader);
+	glDeleteShader(compShader);
+
+	return shader;
 }
 
 unsigned int Renderer::compileShader(std::string name) {
@@ -126,8 +595,7 @@ unsigned int Renderer::compileShader(std::string name) {
 	}
 
 	const char *fragSource;
-	std::ifstream fragFile("res/" + name + ".frag");
-	std::string fragString((std::istreambuf_iterator<char>(fragFile)), std::istreambuf_iterator<char>());
+	std::string fragString = loadSource(name + ".frag");
 	fragSource = fragString.c_str();
 	unsigned int fragShader;
 	fragShader = glCreateShader(GL_FRAGMENT_SHADER);
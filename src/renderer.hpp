@@ -1,20 +1,97 @@
 #pragma once
 
 #include "objects.hpp"
+#include "bvh.hpp"
+#include "scene.hpp"
 
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
 
+// shader storage for one scene array, reallocated only when it outgrows its capacity
+struct StorageBuffer {
+	unsigned int id = 0;
+	int binding = 0;
+	int capacity = 0; // bytes
+	int size = 0; // bytes bound for the shader
+	std::vector<char> shadow; // last contents, for the arrays diffed rather than tracked
+};
+
 class Renderer {
 public:
 	unsigned int shader;
+	unsigned int animateShader; // evaluates the scene's gpu animations, res/animate.comp
 	unsigned int vao;
 	unsigned int vbo;
-	unsigned int uboObjects;
-	const int MAX_OBJECTS = 60;
+	StorageBuffer ssboPlanes;
+	StorageBuffer ssboSpheres;
+	StorageBuffer ssboQuads;
+	StorageBuffer ssboCubes;
+	StorageBuffer ssboVolumes;
+	StorageBuffer ssboLights;
+	StorageBuffer ssboSurfaces;
+	unsigned int ssboEmpty; // bound in place of an empty array, zero bytes
+
+	// planes, spheres, quads and cubes go up as their shapes, the part the intersection loops read.
+	// their palette indices share one buffer in the order planes, spheres, quads, cubes, prefab
+	// spheres, prefab quads, prefab cubes, followed by the palette's colors and materials
+	std::vector<glm::vec4> planeShapes;
+	std::vector<glm::vec4> sphereShapes;
+	std::vector<QuadShape> quadShapes;
+	std::vector<CubeShape> cubeShapes;
+	std::vector<glm::vec4> prefabSphereShapes;
+	std::vector<QuadShape> prefabQuadShapes;
+	std::vector<CubeShape> prefabCubeShapes;
+	std::vector<unsigned int> surfaces; // material index << 16 | color index, then the palette bits
+	int paletteStarts[2] = {0, 0}; // colors, materials, in 16 byte elements of surfaces
+	int surfaceRevision = -1; // scene surface revision of the last upload
+	int surfaceStarts[6] = {0, 0, 0, 0, 0, 0}; // spheres, quads, cubes, prefab spheres, prefab quads, prefab cubes
+
+	// uploads are staged in a persistently mapped ring of three regions and copied into the storage
+	// buffers on the gpu. a region is reused once the fence after its copies has signaled
+	static constexpr int RING_REGIONS = 3;
+	unsigned int ring = 0;
+	char* ringData = nullptr;
+	int ringSize = 0; // bytes per region
+	int ringRegion = 0;
+	int ringOffset = 0;
+	void* ringFences[RING_REGIONS] = {nullptr, nullptr, nullptr};
+	long long uploadedBytes = 0; // last updateBuffers
+	float stallTime = 0.0f; // last updateBuffers, ms waited for the region's fence
+	StorageBuffer ssboNodes;
+	StorageBuffer ssboReferences;
+	StorageBuffer ssboInstances;
+	StorageBuffer ssboPrefabSpheres;
+	StorageBuffer ssboPrefabQuads;
+	StorageBuffer ssboPrefabCubes;
+	StorageBuffer ssboWideNodes;
+	StorageBuffer ssboGrid;
+	StorageBuffer ssboAnimations; // compute pass only
+
+	// offscreen target for headless rendering, read back through two pbos so the copy of
+	// frame n overlaps rendering of frame n+1
+	unsigned int fbo = 0;
+	unsigned int colorBuffer;
+	unsigned int pbos[2];
+	void* fences[2] = {nullptr, nullptr};
+	int readIndex = 0;
+	int targetWidth = 0;
+	int targetHeight = 0;
+	std::vector<glm::vec4> framebuffer; // last frame read back, rgba, top row first
 
 	std::vector<float> vertices;
+	// scene, top level and prefab bvhs concatenated for the shader, in that order
+	std::vector<BVHNode> nodes;
+	std::vector<int> references;
+	std::vector<int> grid; // sphere grid, unbounded lights, light grid
+	int lightListStart = 0;
+	std::vector<int> visible; // references of the primitives in the camera frustum, after the bvhs
+	int visibleStart = 0;
+	float culled = 0.0f; // fraction of the spheres, quads and cubes outside the frustum, last update
+	int culledRevision = -1; // scene revision, view, aspect and accelerator the visible list was culled with
+	glm::mat4 culledView = glm::mat4(0.0f);
+	float culledAspect = 0.0f;
+	int culledAccelerator = -1;
 
 	int bounces = 20;
 	float time;
@@ -22,12 +99,34 @@ public:
 	bool reflections = true;
 	bool lighting = true;
 	bool shadows = true;
+	int accelerator = 0; // 0 linear, 1 bvh, 2 sphere grid
 
 	void init();
 	void update();
 	void draw();
+	void animate();
+
+	void initTarget(int width, int height);
+	bool read();
+	bool collect(int index);
+	void finish();
+	bool save(std::string path);
 
 	void generateBuffers();
 	void updateBuffers();
+	void initStorage(StorageBuffer& buffer, int binding);
+	void beginUpload(int size);
+	bool reserve(StorageBuffer& buffer, int size);
+	void stage(StorageBuffer& buffer, const void* data, int offset, int size);
+	template<typename T>
+	void upload(StorageBuffer& buffer, const std::vector<T>& objects, Dirty& dirty);
+	template<typename T, typename S>
+	void upload(StorageBuffer& buffer, const std::vector<T>& objects, std::vector<S>& shapes, Dirty& dirty);
+	void uploadChanged(StorageBuffer& buffer, const void* data, int size, int stride);
+	void endUpload();
+	void cull();
+	void appendNodes(const std::vector<BVHNode>& nodes, const std::vector<int>& references);
 	unsigned int compileShader(std::string name);
+	unsigned int compileCompute(std::string name);
+	std::string loadSource(std::string name);
 };
@@ -1,5 +1,6 @@
 #include "scene.hpp"
 
+#include <glm/gtc/matrix_transform.hpp>
 #include <random>
 
 float Scene::rnd(float min, float max) {
@@ -13,6 +14,7 @@ void Scene::init() {
 	cubes.reserve(100);
 	volumes.reserve(100);
 	lights.reserve(100);
+	instances.reserve(100);
 	load(1);
 }
 
@@ -25,6 +27,8 @@ void Scene::load(int id) {
 	volumes.clear();
 	lights.clear();
 	updaters.clear();
+	prefabs.clear();
+	instances.clear();
 
 	if (id == 1) {
 		planes.push_back(Plane(glm::vec3(0.0f, 1.0f, 0.0f), -30.0f, glm::vec4(0.5f, 0.5f, 0.5f, 0.2f), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
@@ -75,9 +79,11 @@ void Scene::load(int id) {
 		planes.push_back(Plane(glm::vec3(0.0f, 1.0f, 0.0f), -30.0f, glm::vec4(0.5f, 0.5f, 0.5f, 0.2f), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
 		int n = 4;
 		float w = 10.0f;
+		prefabs.push_back(Prefab());
+		prefabs.back().cubes.push_back(Cube(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(w, 0.0f, 0.0f), glm::vec3(0.0f, w, 0.0f), glm::vec3(0.0f, 0.0f, w), glm::vec4(1.0f, 1.0f, 1.0f, 0.1f), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
 		for (int i=0;i<n;i++) {
 			for (int j=0;j<n-i;j++) {
-				cubes.push_back(Cube(glm::vec3(i*w, (i+j)*w - 15.0f, -j*w - 10.0f), glm::vec3(w, 0.0f, 0.0f), glm::vec3(0.0f, w, 0.0f), glm::vec3(0.0f, 0.0f, w), glm::vec4(rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), 0.1f), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
+				instances.push_back(Instance(0, glm::translate(glm::mat4(1.0f), glm::vec3(i*w, (i+j)*w - 15.0f, -j*w - 10.0f)), glm::vec4(rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), 0.1f)));
 			}
 		}
 		for (int i=0;i<n-1;i++) {
@@ -124,9 +130,11 @@ void Scene::load(int id) {
 		spheres.push_back(Sphere(glm::vec3(0.0f, 80.0f, 0.0f), 10.0f, glm::vec4(rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f))));
 		quads.push_back(Quad(glm::vec3(-200.0f, -40.0f, -200.0f), glm::vec3(400.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 400.0f), glm::vec4(0.3f, 0.3f, 0.3f, 0.6f), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
 		int n = 5;
+		prefabs.push_back(Prefab());
+		prefabs.back().cubes.push_back(Cube(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(10.0f, 0.0f, 0.0f), glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(0.0f, 0.0f, 10.0f), glm::vec4(1.0f, 1.0f, 1.0f, 0.0f), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
 		for (int i=0;i<n;i++) {
 			for (int j=0;j<n;j++) {
-				cubes.push_back(Cube(glm::vec3(20.0f * i - 40.0f - 5.0f, 0.0f, -20.0f * j + 40.0f - 5.0f), glm::vec3(10.0f, 0.0f, 0.0f), glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(0.0f, 0.0f, 10.0f), glm::vec4(rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f)), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
+				instances.push_back(Instance(0, glm::translate(glm::mat4(1.0f), glm::vec3(20.0f * i - 40.0f - 5.0f, 0.0f, -20.0f * j + 40.0f - 5.0f)), glm::vec4(rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f))));
 			}
 		}
 	} else if (id == 9) {
@@ -144,13 +152,62 @@ void Scene::load(int id) {
 		}
 		float w = 20.0f;
 		volumes.push_back(Volume(glm::vec3(0.0f - w/2.0f, 0.0f - w, 0.0f - w/2.0f), glm::vec3(w, 0.0f, 0.0f), glm::vec3(0.0f, w*2.0f, 0.0f), glm::vec3(0.0f, 0.0f, w), glm::vec4(rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), rnd(0.0f, 1.0f), 0.03f), glm::vec4(0.1f, 0.5f, 0.5f, 32.0f)));
+	} else if (id == 10) {
+		// a field of small bobbing lights over a floor of spheres, each reaching a few cells
+		skyColor = glm::vec4(0.05f, 0.05f, 0.1f, 1.0f);
+		planes.push_back(Plane(glm::vec3(0.0f, 1.0f, 0.0f), -10.0f, glm::vec4(0.5f, 0.5f, 0.5f, 0.9f), glm::vec4(0.0f, 0.8f, 0.5f, 32.0f)));
+		int n = 1000;
+		lights.reserve(n);
+		for (int i=0;i<n;i++) {
+			glm::vec3 position = glm::vec3(rnd(-100.0f, 100.0f), rnd(-8.0f, 0.0f), rnd(-200.0f, 0.0f));
+			glm::vec4 color = glm::vec4(rnd(0.2f, 1.0f), rnd(0.2f, 1.0f), rnd(0.2f, 1.0f), 1.0f);
+			lights.push_back(Light(position, color, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f), glm::vec4(15.0f, 1.0f, 0.0f, 0.02f)));
+			updaters.push_back(new BobUpdater(&lights.back().position, glm::vec3(0.0f, 1.0f, 0.0f), -2.0f, 2.0f, rnd(0.5f, 2.0f), rnd(0.0f, 6.28f)));
+		}
+		for (int i=0;i<20;i++) {
+			for (int j=0;j<10;j++) {
+				spheres.push_back(Sphere(glm::vec3(10.0f*i - 95.0f, -7.0f, -20.0f*j - 10.0f), 3.0f, glm::vec4(0.9f, 0.9f, 0.9f, 1.0f), glm::vec4(0.0f, 0.8f, 0.5f, 32.0f)));
+			}
+		}
 	}
+	build();
 }
 
-void Scene::update(float time) {
-	for (int i=0;i<updaters.size();i++) {
-		updaters[i]->update(time);
+template<typename T>
+static void paintObject(Palette& palette, T& object) {
+	object.colorIndex = palette.color(object.color);
+	object.materialIndex = palette.material(object.material);
+}
+
+// collects the colors and materials of the objects into the palette and points them at it
+void Scene::paint() {
+	palette.clear();
+	auto add = [&](auto& objects) {
+		for (int i=0;i<objects.size();i++) {
+			paintObject(palette, objects[i]);
+		}
+	};
+	add(planes);
+	add(spheres);
+	add(quads);
+	add(cubes);
+	for (int p=0;p<prefabs.size();p++) {
+		add(prefabs[p].spheres);
+		add(prefabs[p].quads);
+		add(prefabs[p].cubes);
+	}
+}
+
+// finds the primitives the updaters move and builds the bvh, after objects were added
+void Scene::build() {
+	Dirty* dirty[] = {&dirtyPlanes, &dirtySpheres, &dirtyQuads, &dirtyCubes, &dirtyVolumes, &dirtyLights};
+	revision++;
+	surfaceRevision++;
+	for (int i=0;i<6;i++) {
+		dirty[i]->clear();
+		dirty[i]->all = true;
 	}
+	paint();
 	for (int i=0;i<spheres.size();i++) {
 		spheres[i].generate();
 	}
@@ -160,4 +217,209 @@ void Scene::update(float time) {
 	for (int i=0;i<cubes.size();i++) {
 		cubes[i].generate();
 	}
+	moving.clear();
+	for (int i=0;i<updaters.size();i++) {
+		int ref = reference(updaters[i]->position);
+		if (ref >= 0) {
+			moving.push_back(ref);
+		}
+	}
+	sweep();
+	bvh.build(spheres, quads, cubes);
+	bvhStale = false;
+	grid.build(spheres);
+	buildLights();
+	buildPrefabs();
+	for (int i=0;i<instances.size();i++) {
+		instances[i].generate();
+	}
+	tlas.build(instances);
+}
+
+// builds one bvh per prefab and appends it with the prefab's primitives to the shared prefab
+// arrays, offsetting child, reference and primitive indices. instances pick up their root
+void Scene::buildPrefabs() {
+	prefabSpheres.clear();
+	prefabQuads.clear();
+	prefabCubes.clear();
+	prefabNodes.clear();
+	prefabReferences.clear();
+	std::vector<int> roots;
+	std::vector<BVHNode> rootNodes;
+	for (int p=0;p<prefabs.size();p++) {
+		BVH blas;
+		blas.build(prefabs[p].spheres, prefabs[p].quads, prefabs[p].cubes);
+		int nodeOffset = prefabNodes.size();
+		int referenceOffset = prefabReferences.size();
+		int offsets[3] = {(int)prefabSpheres.size(), (int)prefabQuads.size(), (int)prefabCubes.size()};
+		for (int i=0;i<blas.nodes.size();i++) {
+			BVHNode node = blas.nodes[i];
+			node.start += node.count > 0 ? referenceOffset : nodeOffset;
+			prefabNodes.push_back(node);
+		}
+		for (int i=0;i<blas.references.size();i++) {
+			int type = blas.references[i] >> BVH::TYPE_SHIFT;
+			prefabReferences.push_back(type << BVH::TYPE_SHIFT | ((blas.references[i] & BVH::INDEX_MASK) + offsets[type]));
+		}
+		prefabSpheres.insert(prefabSpheres.end(), prefabs[p].spheres.begin(), prefabs[p].spheres.end());
+		prefabQuads.insert(prefabQuads.end(), prefabs[p].quads.begin(), prefabs[p].quads.end());
+		prefabCubes.insert(prefabCubes.end(), prefabs[p].cubes.begin(), prefabs[p].cubes.end());
+		roots.push_back(blas.nodes.empty() ? -1 : nodeOffset);
+		rootNodes.push_back(blas.nodes.empty() ? BVHNode{} : blas.nodes[0]);
+	}
+	for (int i=0;i<instances.size();i++) {
+		instances[i].root = roots[instances[i].prefab];
+		instances[i].localBounds[0] = glm::vec4(rootNodes[instances[i].prefab].min, 0.0f);
+		instances[i].localBounds[1] = glm::vec4(rootNodes[instances[i].prefab].max, 0.0f);
+	}
+}
+
+void Scene::buildLights() {
+	globalLights.clear();
+	for (int i=0;i<lights.size();i++) {
+		if (lights[i].attenuation.x <= 0.0f) {
+			globalLights.push_back(i);
+		}
+	}
+	lightGrid.build(lights, lightSweeps);
+}
+
+// for gpu animation: hands the closed-form updaters to the compute pass and widens the bounds of the
+// objects they move to all they sweep over, so the bvh and grids built from them hold at any time.
+// the cpu copies keep their positions, the compute pass writes the moving ones and exact bounds
+void Scene::sweep() {
+	animations.clear();
+	hostUpdaters.clear();
+	lightSweeps.clear();
+	if (!gpuAnimation) {
+		return;
+	}
+	for (int i=0;i<lights.size();i++) {
+		lightSweeps.push_back(glm::vec3(lights[i].position));
+		lightSweeps.push_back(glm::vec3(lights[i].position));
+	}
+	for (int i=0;i<updaters.size();i++) {
+		Animation animation;
+		int array, index;
+		if (!locate(updaters[i]->position, array, index) || array == PLANES || array == VOLUMES || !updaters[i]->animate(animation)) {
+			hostUpdaters.push_back(updaters[i]);
+			continue;
+		}
+		animation.target = glm::ivec4(array, index, 0, 0);
+		animations.push_back(animation);
+
+		glm::vec3 lo, hi;
+		updaters[i]->extent(lo, hi);
+		if (array == LIGHTS) {
+			lightSweeps[2*index] = glm::min(lightSweeps[2*index], lo);
+			lightSweeps[2*index + 1] = glm::max(lightSweeps[2*index + 1], hi);
+			continue;
+		}
+		// quad and cube bounds are corner to opposite corner, the swept box is min to max
+		glm::vec4* bounds = array == SPHERES ? spheres[index].bounds : array == QUADS ? quads[index].bounds : cubes[index].bounds;
+		glm::vec3 position = glm::vec3(*updaters[i]->position);
+		glm::vec3 a = glm::min(glm::vec3(bounds[0]), glm::vec3(bounds[1])) - position;
+		glm::vec3 b = glm::max(glm::vec3(bounds[0]), glm::vec3(bounds[1])) - position;
+		bounds[0] = glm::vec4(lo + a, 0.0f);
+		bounds[1] = glm::vec4(hi + b, 0.0f);
+	}
+}
+
+void Scene::update(float time) {
+	std::vector<Updater*>& active = gpuAnimation ? hostUpdaters : updaters;
+	for (int i=0;i<active.size();i++) {
+		active[i]->update(time);
+		move(active[i]->position);
+	}
+	if (!gpuAnimation) {
+		for (int i=0;i<spheres.size();i++) {
+			spheres[i].generate();
+		}
+		for (int i=0;i<quads.size();i++) {
+			quads[i].generate();
+		}
+		for (int i=0;i<cubes.size();i++) {
+			cubes[i].generate();
+		}
+		// the bvh only follows the updaters while it is the accelerator and catches up with a full
+		// refit when it becomes it again. the grid is rebuilt from scratch anyway
+		if (accelerator == 1) {
+			bvh.refit(moving, bvhStale);
+			bvhStale = false;
+		} else {
+			bvh.refitTime = 0.0f;
+			bvhStale = bvhStale || !moving.empty();
+		}
+		if (accelerator == 2) {
+			grid.build(spheres);
+		}
+		buildLights();
+	}
+	// with the animations on the gpu only the host updaters can move instances
+	if (!gpuAnimation || !active.empty()) {
+		for (int i=0;i<instances.size();i++) {
+			instances[i].generate();
+		}
+		tlas.build(instances);
+	}
+}
+
+// bvh reference of the sphere, quad or cube owning a position, -1 for anything else
+int Scene::reference(const glm::vec4* position) {
+	const Sphere* sphere = (const Sphere*)position;
+	if (sphere >= spheres.data() && sphere < spheres.data() + spheres.size()) {
+		return BVH::SPHERE << BVH::TYPE_SHIFT | (int)(sphere - spheres.data());
+	}
+	const Quad* quad = (const Quad*)position;
+	if (quad >= quads.data() && quad < quads.data() + quads.size()) {
+		return BVH::QUAD << BVH::TYPE_SHIFT | (int)(quad - quads.data());
+	}
+	const Cube* cube = (const Cube*)position;
+	if (cube >= cubes.data() && cube < cubes.data() + cubes.size()) {
+		return BVH::CUBE << BVH::TYPE_SHIFT | (int)(cube - cubes.data());
+	}
+	return -1;
+}
+
+template<typename T>
+bool find(const std::vector<T>& objects, const void* object, int& index) {
+	const T* p = (const T*)object;
+	index = p - objects.data();
+	return p >= objects.data() && p < objects.data() + objects.size();
+}
+
+// scene array and index of the plane, sphere, quad, cube, volume or light at object
+bool Scene::locate(const void* object, int& array, int& index) {
+	array = find(planes, object, index) ? PLANES : find(spheres, object, index) ? SPHERES : find(quads, object, index) ? QUADS :
+		find(cubes, object, index) ? CUBES : find(volumes, object, index) ? VOLUMES : find(lights, object, index) ? LIGHTS : -1;
+	return array >= 0;
+}
+
+// marks the object at object for the next upload, after changing it, and points it at its color
+// and material in the palette
+void Scene::edit(const void* object) {
+	surfaceRevision++;
+	move(object);
+	int array, index;
+	if (locate(object, array, index)) {
+		if (array == PLANES) {
+			paintObject(palette, planes[index]);
+		} else if (array == SPHERES) {
+			paintObject(palette, spheres[index]);
+		} else if (array == QUADS) {
+			paintObject(palette, quads[index]);
+		} else if (array == CUBES) {
+			paintObject(palette, cubes[index]);
+		}
+	}
+}
+
+// edit() for an updater's move, which leaves the object's palette indices as they were
+void Scene::move(const void* object) {
+	Dirty* dirty[] = {&dirtyPlanes, &dirtySpheres, &dirtyQuads, &dirtyCubes, &dirtyVolumes, &dirtyLights};
+	revision++;
+	int array, index;
+	if (locate(object, array, index)) {
+		dirty[array]->mark(index);
+	}
 }
@@ -1,11 +1,100 @@
 #pragma once
 
 #include "objects.hpp"
+#include "bvh.hpp"
+#include "grid.hpp"
 
+#include <array>
+#include <cstring>
+#include <map>
 #include <vector>
 
+// geometry authored once in local space and placed any number of times by instances
+struct Prefab {
+	std::vector<Sphere> spheres;
+	std::vector<Quad> quads;
+	std::vector<Cube> cubes;
+};
+
+// objects of one scene array changed since the renderer last uploaded it, each index listed once
+struct Dirty {
+	bool all = true; // the whole array, after a load
+	std::vector<int> indices;
+	std::vector<unsigned char> marked;
+
+	void mark(int index) {
+		if (all) {
+			return;
+		}
+		if (index >= marked.size()) {
+			marked.resize(index + 1, 0);
+		}
+		if (!marked[index]) {
+			marked[index] = 1;
+			indices.push_back(index);
+		}
+	}
+
+	void clear() {
+		for (int i=0;i<indices.size();i++) {
+			marked[indices[i]] = 0;
+		}
+		indices.clear();
+		all = false;
+	}
+};
+
+// the distinct colors and materials of the planes, spheres, quads and cubes, prefabs included. the
+// objects keep their authored vec4s and 16 bit indices into it, which the renderers read
+struct Palette {
+	std::vector<glm::vec4> colors;
+	std::vector<glm::vec4> materials;
+	std::map<std::array<unsigned int, 4>, int> colorLookup;
+	std::map<std::array<unsigned int, 4>, int> materialLookup;
+
+	unsigned short color(glm::vec4 value) {
+		return intern(colors, colorLookup, value);
+	}
+
+	unsigned short material(glm::vec4 value) {
+		return intern(materials, materialLookup, value);
+	}
+
+	void clear() {
+		colors.clear();
+		materials.clear();
+		colorLookup.clear();
+		materialLookup.clear();
+	}
+
+	// index of value in entries by its bits, appended when it is new
+	unsigned short intern(std::vector<glm::vec4>& entries, std::map<std::array<unsigned int, 4>, int>& lookup, glm::vec4 value) {
+		std::array<unsigned int, 4> key;
+		std::memcpy(key.data(), &value, sizeof(key));
+		auto it = lookup.find(key);
+		if (it != lookup.end()) {
+			return it->second;
+		}
+		if (entries.size() > 0xffff) {
+			std::cout << "palette full, reusing its last entry" << std::endl;
+			return 0xffff;
+		}
+		lookup[key] = entries.size();
+		entries.push_back(value);
+		return entries.size() - 1;
+	}
+};
+
 class Scene {
 public:
+	// scene arrays, as edit() and Animation::target name them
+	static constexpr int PLANES = 0;
+	static constexpr int SPHERES = 1;
+	static constexpr int QUADS = 2;
+	static constexpr int CUBES = 3;
+	static constexpr int VOLUMES = 4;
+	static constexpr int LIGHTS = 5;
+
 	std::vector<Plane> planes;
 	std::vector<Sphere> spheres;
 	std::vector<Quad> quads;
@@ -13,6 +102,42 @@ public:
 	std::vector<Volume> volumes;
 	std::vector<Light> lights;
 	std::vector<Updater*> updaters;
+	// marked by the updaters bound to an object every update and by edit()
+	Dirty dirtyPlanes;
+	Dirty dirtySpheres;
+	Dirty dirtyQuads;
+	Dirty dirtyCubes;
+	Dirty dirtyVolumes;
+	Dirty dirtyLights;
+	int revision = 0; // counts builds and edits, the renderer skips its per frame work while it holds
+	int surfaceRevision = 0; // counts builds and edits but not updater moves, the palette and its indices hold with it
+	BVH bvh; // over spheres, quads and cubes, refit every frame while it is the accelerator
+	bool bvhStale = false; // the updaters moved primitives while it was not
+	std::vector<int> moving; // bvh references of the primitives bound to an updater
+	Grid grid; // over the spheres, rebuilt every frame while it is the accelerator
+	int accelerator = 0; // the renderer's, set by the renderer and tracer before update()
+	Grid lightGrid; // over the lights with a radius, rebuilt every frame
+	std::vector<int> globalLights; // lights without a radius, they reach every point
+
+	// the updaters moving spheres, quads, cubes and lights run in the renderer's compute pass rather
+	// than update(), see sweep()
+	bool gpuAnimation = false;
+	std::vector<Animation> animations;
+	std::vector<Updater*> hostUpdaters; // the rest, still run by update()
+	std::vector<glm::vec3> lightSweeps; // per light, lo and hi of the box its position moves in
+
+	std::vector<Prefab> prefabs;
+	std::vector<Instance> instances;
+	BVH tlas; // over the instances, rebuilt every frame
+	// every prefab's primitives and bvh, appended once by build(). prefab nodes start at
+	// Instance::root and their references index the prefab primitives
+	std::vector<Sphere> prefabSpheres;
+	std::vector<Quad> prefabQuads;
+	std::vector<Cube> prefabCubes;
+	std::vector<BVHNode> prefabNodes;
+	std::vector<int> prefabReferences;
+
+	Palette palette; // filled by build(), edit() adds the surface of the object it is given
 
 	glm::vec4 skyColor = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f); // r, g, b, gradient bottom
 
@@ -21,4 +146,13 @@ public:
 	void init();
 	void load(int id);
 	void update(float time);
+	void build();
+	void paint();
+	void buildPrefabs();
+	void buildLights();
+	void sweep();
+	int reference(const glm::vec4* position);
+	bool locate(const void* object, int& array, int& index);
+	void edit(const void* object);
+	void move(const void* object);
 };
@@ -0,0 +1,187 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TileScheduler::~TileScheduler() {
+	exit();
+}
+
+void TileScheduler::init(int threads) {
+	exit();
+	this->threads = std::max(1, threads);
+	stopping = false;
+	queues.clear();
+	for (int i=0;i<this->threads;i++) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+	threadStats.assign(this->threads, {});
+	// the calling thread works as thread 0
+	for (int i=1;i<this->threads;i++) {
+		workers.push_back(std::thread(&TileScheduler::worker, this, i));
+	}
+}
+
+void TileScheduler::exit() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	started.notify_all();
+	for (int i=0;i<workers.size();i++) {
+		workers[i].join();
+	}
+	workers.clear();
+}
+
+void TileScheduler::run(int width, int height, std::function<void(const Tile&)> work) {
+	std::vector<Tile> tiles;
+	for (int y=0;y<height;y+=tileSize) {
+		for (int x=0;x<width;x+=tileSize) {
+			tiles.push_back({x, y, std::min(tileSize, width - x), std::min(tileSize, height - y)});
+		}
+	}
+	run(tiles, work);
+}
+
+void TileScheduler::run(int count, std::function<void(int begin, int end)> work) {
+	// a 1d range as a row of tiles with the same area as the 2d ones
+	std::vector<Tile> tiles;
+	int size = tileSize * tileSize;
+	for (int x=0;x<count;x+=size) {
+		tiles.push_back({x, 0, std::min(size, count - x), 1});
+	}
+	run(tiles, [&](const Tile& tile) { work(tile.x, tile.x + tile.width); });
+}
+
+void TileScheduler::run(const std::vector<Tile>& tiles, std::function<void(const Tile&)> work) {
+	auto start = std::chrono::steady_clock::now();
+	this->work = work;
+	stolen = 0;
+	split = 0;
+	for (int i=0;i<threads;i++) {
+		threadStats[i].clear();
+	}
+
+	// contiguous runs of tiles per thread so each starts on a coherent region of the image
+	pending = tiles.size();
+	queued = tiles.size();
+	for (int i=0;i<tiles.size();i++) {
+		queues[(long long)i * threads / tiles.size()]->tiles.push_front(tiles[i]);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frame++;
+		active = threads - 1;
+	}
+	started.notify_all();
+	process(0);
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [&]() { return active == 0; });
+	}
+
+	frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	steals = stolen;
+	splits = split;
+	busyTime = 0.0;
+	stats.clear();
+	for (int i=0;i<threads;i++) {
+		for (int j=0;j<threadStats[i].size();j++) {
+			busyTime += threadStats[i][j].time;
+		}
+		stats.insert(stats.end(), threadStats[i].begin(), threadStats[i].end());
+	}
+}
+
+void TileScheduler::worker(int id) {
+	int seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			started.wait(lock, [&]() { return stopping || frame != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = frame;
+		}
+		process(id);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active--;
+		}
+		finished.notify_one();
+	}
+}
+
+void TileScheduler::process(int id) {
+	while (pending > 0) {
+		Tile tile;
+		bool wasStolen;
+		if (!pop(id, tile, wasStolen)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		while (threads > 1 && tile.width * tile.height > minTileSize * minTileSize && queued < threads * 2) {
+			Tile rest = tile;
+			if (tile.width >= tile.height) {
+				tile.width /= 2;
+				rest.x += tile.width;
+				rest.width -= tile.width;
+			} else {
+				tile.height /= 2;
+				rest.y += tile.height;
+				rest.height -= tile.height;
+			}
+			pending++;
+			push(id, rest);
+			split++;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		work(tile);
+		float time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		threadStats[id].push_back({tile, id, time, wasStolen});
+		pending--;
+	}
+}
+
+bool TileScheduler::pop(int id, Tile& tile, bool& wasStolen) {
+	{
+		Queue& own = *queues[id];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tiles.empty()) {
+			tile = own.tiles.back();
+			own.tiles.pop_back();
+			queued--;
+			wasStolen = false;
+			return true;
+		}
+	}
+	for (int i=1;i<threads;i++) {
+		Queue& victim = *queues[(id + i) % threads];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tiles.empty()) {
+			tile = victim.tiles.front();
+			victim.tiles.pop_front();
+			queued--;
+			stolen++;
+			wasStolen = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileScheduler::push(int id, Tile tile) {
+	Queue& own = *queues[id];
+	std::lock_guard<std::mutex> lock(own.mutex);
+	own.tiles.push_back(tile);
+	queued++;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Tile {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+struct TileStats {
+	Tile tile;
+	int thread;
+	float time; // ms
+	bool stolen;
+};
+
+// persistent worker pool with one tile deque per thread. owners pop from the back, idle threads
+// steal from the front of the others, and tiles are split in half while the queues run low
+// so the end of a frame is still spread across every thread.
+class TileScheduler {
+public:
+	int threads = 1;
+	int tileSize = 64;
+	int minTileSize = 8;
+
+	std::vector<TileStats> stats; // last frame
+	int steals = 0;
+	int splits = 0;
+	double frameTime = 0.0; // ms
+	double busyTime = 0.0; // ms, summed over threads
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Tile> tiles;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::vector<TileStats>> threadStats;
+	std::vector<std::thread> workers;
+	std::function<void(const Tile&)> work;
+
+	std::mutex mutex;
+	std::condition_variable started;
+	std::condition_variable finished;
+	int frame = 0;
+	int active = 0;
+	bool stopping = false;
+	std::atomic<int> pending = 0; // queued or in progress
+	std::atomic<int> queued = 0;
+	std::atomic<int> stolen = 0;
+	std::atomic<int> split = 0;
+
+	~TileScheduler();
+
+	void init(int threads);
+	void run(int width, int height, std::function<void(const Tile&)> work);
+	void run(int count, std::function<void(int begin, int end)> work);
+	void run(const std::vector<Tile>& tiles, std::function<void(const Tile&)> work);
+	void exit();
+
+	void worker(int id);
+	void process(int id);
+	bool pop(int id, Tile& tile, bool& wasStolen);
+	void push(int id, Tile tile);
+};
@@ -0,0 +1,32 @@
+#include "simd.hpp"
+
+#include <cstring>
+
+static bool supported(const Kernels& kernels) {
+	if (kernels.nearestSphere == nullptr) {
+		return false;
+	}
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (&kernels == &avx2Kernels) {
+		return __builtin_cpu_supports("avx2");
+	}
+	if (&kernels == &sse4Kernels) {
+		return __builtin_cpu_supports("sse4.1");
+	}
+#endif
+	return &kernels == &scalarKernels;
+}
+
+const Kernels* selectKernels(const char* name) {
+	const Kernels* candidates[] = {&avx2Kernels, &sse4Kernels, &scalarKernels};
+	for (const Kernels* kernels : candidates) {
+		if (name != nullptr && std::strcmp(name, kernels->name) != 0) {
+			continue;
+		}
+		if (supported(*kernels)) {
+			return kernels;
+		}
+	}
+	return &scalarKernels;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// plain views over the structure-of-arrays mirror in packed.hpp, kept free of glm and std
+// so the per-isa translation units don't emit shared inline code built with wider instructions.
+// every array is padded to a multiple of 8 with nan lanes that never hit.
+
+struct RayLane {
+	float ox, oy, oz;
+	float dx, dy, dz;
+	float ix, iy, iz;
+};
+
+struct RayLanes {
+	float ox[8], oy[8], oz[8];
+	float dx[8], dy[8], dz[8];
+	float ix[8], iy[8], iz[8];
+};
+
+struct BoxLanes {
+	const float* minX; const float* minY; const float* minZ;
+	const float* maxX; const float* maxY; const float* maxZ;
+	int count;
+};
+
+struct SphereLanes {
+	const float* x; const float* y; const float* z; const float* r;
+	int count;
+};
+
+struct QuadLanes {
+	const float* px; const float* py; const float* pz;
+	const float* ax; const float* ay; const float* az; // edge 1
+	const float* bx; const float* by; const float* bz; // edge 2
+	const float* nx; const float* ny; const float* nz; const float* nw;
+	BoxLanes bounds;
+	int count;
+};
+
+struct Kernels {
+	const char* name;
+
+	// 1 ray against n primitives, returns the index of the closest hit with near < t < *t and updates *t, or -1
+	int (*nearestSphere)(const RayLane& ray, const SphereLanes& spheres, float near, float* t);
+	int (*nearestQuad)(const RayLane& ray, const QuadLanes& quads, float near, float* t);
+	// 1 ray against n boxes, writes the indices of overlapped boxes and returns how many
+	int (*overlapBoxes)(const RayLane& ray, const BoxLanes& boxes, int* indices);
+
+	// 8 rays against 1 primitive, t is -1 on a miss
+	void (*sphereRays)(const RayLanes& rays, const float sphere[4], float t[8]);
+	void (*quadRays)(const RayLanes& rays, const QuadLanes& quads, int index, float t[8]);
+	unsigned int (*boxRays)(const RayLanes& rays, const float bounds[6]);
+};
+
+extern const Kernels scalarKernels;
+extern const Kernels sse4Kernels;
+extern const Kernels avx2Kernels;
+
+// picks the widest kernels supported by the running cpu, or the named ones if available
+const Kernels* selectKernels(const char* name = nullptr);
@@ -0,0 +1,34 @@
+#include "simd.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace {
+	const int W = 8;
+	typedef __m256 V;
+	typedef __m256 M;
+
+	// operands of min/max are swapped so nan lanes resolve the same way as glm::min/glm::max
+	inline V load(const float* p) { return _mm256_loadu_ps(p); }
+	inline V set(float x) { return _mm256_set1_ps(x); }
+	inline void store(float* p, V a) { _mm256_storeu_ps(p, a); }
+	inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+	inline V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+	inline V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+	inline V div(V a, V b) { return _mm256_div_ps(a, b); }
+	inline V min(V a, V b) { return _mm256_min_ps(b, a); }
+	inline V max(V a, V b) { return _mm256_max_ps(b, a); }
+	inline V sqrt(V a) { return _mm256_sqrt_ps(a); }
+	inline M gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	inline M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	inline M ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	inline M both(M a, M b) { return _mm256_and_ps(a, b); }
+	inline int bits(M a) { return _mm256_movemask_ps(a); }
+
+	#include "simd_kernels.inl"
+}
+
+const Kernels avx2Kernels = {"avx2", nearestSphere, nearestQuad, overlapBoxes, sphereRays, quadRays, boxRays};
+#else
+const Kernels avx2Kernels = {"avx2", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+#endif
@@ -0,0 +1,188 @@
+// shared kernel bodies, included inside an anonymous namespace by each isa translation unit
+// after it defines W, V, M and load/set/store/add/sub/mul/div/min/max/sqrt/gt/lt/ge/both/bits
+
+inline V dot3(V ax, V ay, V az, V bx, V by, V bz) {
+	return add(add(mul(ax, bx), mul(ay, by)), mul(az, bz));
+}
+
+// dot(cross(a, b), n)
+inline V triple(V ax, V ay, V az, V bx, V by, V bz, V nx, V ny, V nz) {
+	V cx = sub(mul(ay, bz), mul(az, by));
+	V cy = sub(mul(az, bx), mul(ax, bz));
+	V cz = sub(mul(ax, by), mul(ay, bx));
+	return dot3(cx, cy, cz, nx, ny, nz);
+}
+
+inline M box(V ox, V oy, V oz, V ix, V iy, V iz, V minX, V minY, V minZ, V maxX, V maxY, V maxZ) {
+	V tx0 = mul(sub(minX, ox), ix);
+	V tx1 = mul(sub(maxX, ox), ix);
+	V tmin = min(tx0, tx1);
+	V tmax = max(tx0, tx1);
+
+	V ty0 = mul(sub(minY, oy), iy);
+	V ty1 = mul(sub(maxY, oy), iy);
+	tmin = max(tmin, min(ty0, ty1));
+	tmax = min(tmax, max(ty0, ty1));
+
+	V tz0 = mul(sub(minZ, oz), iz);
+	V tz1 = mul(sub(maxZ, oz), iz);
+	tmin = max(tmin, min(tz0, tz1));
+	tmax = min(tmax, max(tz0, tz1));
+
+	return ge(tmax, tmin);
+}
+
+inline V sphere(V ox, V oy, V oz, V dx, V dy, V dz, V cx, V cy, V cz, V r, M* valid) {
+	V a = dot3(dx, dy, dz, dx, dy, dz);
+	V offX = sub(ox, cx);
+	V offY = sub(oy, cy);
+	V offZ = sub(oz, cz);
+	V b = mul(set(2.0f), dot3(dx, dy, dz, offX, offY, offZ));
+	V c = sub(dot3(offX, offY, offZ, offX, offY, offZ), mul(r, r));
+	V disc = sub(mul(b, b), mul(set(4.0f), mul(a, c)));
+	*valid = ge(disc, set(0.0f));
+	return div(sub(sub(set(0.0f), b), sqrt(disc)), mul(set(2.0f), a));
+}
+
+inline V quad(V ox, V oy, V oz, V dx, V dy, V dz, V px, V py, V pz, V ax, V ay, V az, V bx, V by, V bz, V nx, V ny, V nz, V nw, M* valid) {
+	V a = dot3(dx, dy, dz, nx, ny, nz);
+	V t = div(dot3(sub(mul(nx, nw), ox), sub(mul(ny, nw), oy), sub(mul(nz, nw), oz), nx, ny, nz), a);
+	V offX = sub(add(ox, mul(dx, t)), px);
+	V offY = sub(add(oy, mul(dy, t)), py);
+	V offZ = sub(add(oz, mul(dz, t)), pz);
+
+	V v1 = triple(ax, ay, az, offX, offY, offZ, nx, ny, nz);
+	V v2 = triple(offX, offY, offZ, bx, by, bz, nx, ny, nz);
+	V v3 = triple(ax, ay, az, sub(bx, offX), sub(by, offY), sub(bz, offZ), nx, ny, nz);
+	V v4 = triple(sub(ax, offX), sub(ay, offY), sub(az, offZ), bx, by, bz, nx, ny, nz);
+
+	V zero = set(0.0f);
+	M facing = ge(max(a, sub(zero, a)), set(0.001f));
+	M inside = both(both(gt(v1, zero), gt(v2, zero)), both(gt(v3, zero), gt(v4, zero)));
+	*valid = both(inside, facing);
+	return t;
+}
+
+int nearestSphere(const RayLane& ray, const SphereLanes& spheres, float near, float* t) {
+	V ox = set(ray.ox), oy = set(ray.oy), oz = set(ray.oz);
+	V dx = set(ray.dx), dy = set(ray.dy), dz = set(ray.dz);
+	V vnear = set(near);
+	float best = *t;
+	int index = -1;
+	float lanes[W];
+	for (int i=0;i<spheres.count;i+=W) {
+		M valid;
+		V tt = sphere(ox, oy, oz, dx, dy, dz, load(spheres.x + i), load(spheres.y + i), load(spheres.z + i), load(spheres.r + i), &valid);
+		int hits = bits(both(valid, both(gt(tt, vnear), lt(tt, set(best)))));
+		if (hits == 0) {
+			continue;
+		}
+		store(lanes, tt);
+		for (int j=0;j<W;j++) {
+			if ((hits >> j & 1) && lanes[j] < best) {
+				best = lanes[j];
+				index = i + j;
+			}
+		}
+	}
+	*t = best;
+	return index;
+}
+
+int nearestQuad(const RayLane& ray, const QuadLanes& quads, float near, float* t) {
+	V ox = set(ray.ox), oy = set(ray.oy), oz = set(ray.oz);
+	V dx = set(ray.dx), dy = set(ray.dy), dz = set(ray.dz);
+	V ix = set(ray.ix), iy = set(ray.iy), iz = set(ray.iz);
+	V vnear = set(near);
+	const BoxLanes& b = quads.bounds;
+	float best = *t;
+	int index = -1;
+	float lanes[W];
+	for (int i=0;i<quads.count;i+=W) {
+		M overlap = box(ox, oy, oz, ix, iy, iz, load(b.minX + i), load(b.minY + i), load(b.minZ + i), load(b.maxX + i), load(b.maxY + i), load(b.maxZ + i));
+		if (bits(overlap) == 0) {
+			continue;
+		}
+		M valid;
+		V tt = quad(ox, oy, oz, dx, dy, dz,
+			load(quads.px + i), load(quads.py + i), load(quads.pz + i),
+			load(quads.ax + i), load(quads.ay + i), load(quads.az + i),
+			load(quads.bx + i), load(quads.by + i), load(quads.bz + i),
+			load(quads.nx + i), load(quads.ny + i), load(quads.nz + i), load(quads.nw + i), &valid);
+		int hits = bits(both(both(overlap, valid), both(gt(tt, vnear), lt(tt, set(best)))));
+		if (hits == 0) {
+			continue;
+		}
+		store(lanes, tt);
+		for (int j=0;j<W;j++) {
+			if ((hits >> j & 1) && lanes[j] < best) {
+				best = lanes[j];
+				index = i + j;
+			}
+		}
+	}
+	*t = best;
+	return index;
+}
+
+int overlapBoxes(const RayLane& ray, const BoxLanes& boxes, int* indices) {
+	V ox = set(ray.ox), oy = set(ray.oy), oz = set(ray.oz);
+	V ix = set(ray.ix), iy = set(ray.iy), iz = set(ray.iz);
+	int count = 0;
+	for (int i=0;i<boxes.count;i+=W) {
+		int hits = bits(box(ox, oy, oz, ix, iy, iz, load(boxes.minX + i), load(boxes.minY + i), load(boxes.minZ + i), load(boxes.maxX + i), load(boxes.maxY + i), load(boxes.maxZ + i)));
+		while (hits != 0) {
+			int j = __builtin_ctz(hits);
+			indices[count++] = i + j;
+			hits &= hits - 1;
+		}
+	}
+	return count;
+}
+
+void sphereRays(const RayLanes& rays, const float sphere4[4], float t[8]) {
+	V cx = set(sphere4[0]), cy = set(sphere4[1]), cz = set(sphere4[2]), r = set(sphere4[3]);
+	float lanes[W];
+	for (int i=0;i<8;i+=W) {
+		M valid;
+		V tt = sphere(load(rays.ox + i), load(rays.oy + i), load(rays.oz + i), load(rays.dx + i), load(rays.dy + i), load(rays.dz + i), cx, cy, cz, r, &valid);
+		int hits = bits(valid);
+		store(lanes, tt);
+		for (int j=0;j<W;j++) {
+			t[i + j] = (hits >> j & 1) ? lanes[j] : -1.0f;
+		}
+	}
+}
+
+void quadRays(const RayLanes& rays, const QuadLanes& quads, int index, float t[8]) {
+	const BoxLanes& b = quads.bounds;
+	V minX = set(b.minX[index]), minY = set(b.minY[index]), minZ = set(b.minZ[index]);
+	V maxX = set(b.maxX[index]), maxY = set(b.maxY[index]), maxZ = set(b.maxZ[index]);
+	V px = set(quads.px[index]), py = set(quads.py[index]), pz = set(quads.pz[index]);
+	V ax = set(quads.ax[index]), ay = set(quads.ay[index]), az = set(quads.az[index]);
+	V bx = set(quads.bx[index]), by = set(quads.by[index]), bz = set(quads.bz[index]);
+	V nx = set(quads.nx[index]), ny = set(quads.ny[index]), nz = set(quads.nz[index]), nw = set(quads.nw[index]);
+	float lanes[W];
+	for (int i=0;i<8;i+=W) {
+		V ox = load(rays.ox + i), oy = load(rays.oy + i), oz = load(rays.oz + i);
+		M overlap = box(ox, oy, oz, load(rays.ix + i), load(rays.iy + i), load(rays.iz + i), minX, minY, minZ, maxX, maxY, maxZ);
+		M valid;
+		V tt = quad(ox, oy, oz, load(rays.dx + i), load(rays.dy + i), load(rays.dz + i), px, py, pz, ax, ay, az, bx, by, bz, nx, ny, nz, nw, &valid);
+		int hits = bits(both(overlap, valid));
+		store(lanes, tt);
+		for (int j=0;j<W;j++) {
+			t[i + j] = (hits >> j & 1) ? lanes[j] : -1.0f;
+		}
+	}
+}
+
+unsigned int boxRays(const RayLanes& rays, const float bounds[6]) {
+	V minX = set(bounds[0]), minY = set(bounds[1]), minZ = set(bounds[2]);
+	V maxX = set(bounds[3]), maxY = set(bounds[4]), maxZ = set(bounds[5]);
+	unsigned int mask = 0;
+	for (int i=0;i<8;i+=W) {
+		M hit = box(load(rays.ox + i), load(rays.oy + i), load(rays.oz + i), load(rays.ix + i), load(rays.iy + i), load(rays.iz + i), minX, minY, minZ, maxX, maxY, maxZ);
+		mask |= (unsigned int)bits(hit) << i;
+	}
+	return mask;
+}
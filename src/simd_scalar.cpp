@@ -0,0 +1,27 @@
+#include "simd.hpp"
+
+namespace {
+	const int W = 1;
+	typedef float V;
+	typedef bool M;
+
+	inline V load(const float* p) { return *p; }
+	inline V set(float x) { return x; }
+	inline void store(float* p, V a) { *p = a; }
+	inline V add(V a, V b) { return a + b; }
+	inline V sub(V a, V b) { return a - b; }
+	inline V mul(V a, V b) { return a * b; }
+	inline V div(V a, V b) { return a / b; }
+	inline V min(V a, V b) { return b < a ? b : a; }
+	inline V max(V a, V b) { return a < b ? b : a; }
+	inline V sqrt(V a) { return __builtin_sqrtf(a); }
+	inline M gt(V a, V b) { return a > b; }
+	inline M lt(V a, V b) { return a < b; }
+	inline M ge(V a, V b) { return a >= b; }
+	inline M both(M a, M b) { return a && b; }
+	inline int bits(M a) { return a ? 1 : 0; }
+
+	#include "simd_kernels.inl"
+}
+
+const Kernels scalarKernels = {"scalar", nearestSphere, nearestQuad, overlapBoxes, sphereRays, quadRays, boxRays};
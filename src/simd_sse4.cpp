@@ -0,0 +1,34 @@
+#include "simd.hpp"
+
+#if defined(__SSE4_1__)
+#include <immintrin.h>
+
+namespace {
+	const int W = 4;
+	typedef __m128 V;
+	typedef __m128 M;
+
+	// operands of min/max are swapped so nan lanes resolve the same way as glm::min/glm::max
+	inline V load(const float* p) { return _mm_loadu_ps(p); }
+	inline V set(float x) { return _mm_set1_ps(x); }
+	inline void store(float* p, V a) { _mm_storeu_ps(p, a); }
+	inline V add(V a, V b) { return _mm_add_ps(a, b); }
+	inline V sub(V a, V b) { return _mm_sub_ps(a, b); }
+	inline V mul(V a, V b) { return _mm_mul_ps(a, b); }
+	inline V div(V a, V b) { return _mm_div_ps(a, b); }
+	inline V min(V a, V b) { return _mm_min_ps(b, a); }
+	inline V max(V a, V b) { return _mm_max_ps(b, a); }
+	inline V sqrt(V a) { return _mm_sqrt_ps(a); }
+	inline M gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+	inline M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+	inline M ge(V a, V b) { return _mm_cmpge_ps(a, b); }
+	inline M both(M a, M b) { return _mm_and_ps(a, b); }
+	inline int bits(M a) { return _mm_movemask_ps(a); }
+
+	#include "simd_kernels.inl"
+}
+
+const Kernels sse4Kernels = {"sse4", nearestSphere, nearestQuad, overlapBoxes, sphereRays, quadRays, boxRays};
+#else
+const Kernels sse4Kernels = {"sse4", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+#endif
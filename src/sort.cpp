@@ -0,0 +1,108 @@
+#include "sort.hpp"
+
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <vector>
+
+static unsigned int spread(unsigned int x) {
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+unsigned int morton3(unsigned int x, unsigned int y, unsigned int z) {
+	return (spread(x) << 2) | (spread(y) << 1) | spread(z);
+}
+
+static unsigned long long spreadWide(unsigned int v) {
+	unsigned long long x = v & 0x1fffff;
+	x = (x | (x << 32)) & 0x1f00000000ffffull;
+	x = (x | (x << 16)) & 0x1f0000ff0000ffull;
+	x = (x | (x << 8)) & 0x100f00f00f00f00full;
+	x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+	x = (x | (x << 2)) & 0x1249249249249249ull;
+	return x;
+}
+
+unsigned long long morton3Wide(unsigned int x, unsigned int y, unsigned int z) {
+	return (spreadWide(x) << 2) | (spreadWide(y) << 1) | spreadWide(z);
+}
+
+void radixSort(std::vector<unsigned int>& keys, std::vector<int>& values, int bits) {
+	std::vector<unsigned int> keysTemp(keys.size());
+	std::vector<int> valuesTemp(values.size());
+	for (int shift=0;shift<bits;shift+=8) {
+		int counts[257] = {0};
+		for (int i=0;i<keys.size();i++) {
+			counts[((keys[i] >> shift) & 0xff) + 1]++;
+		}
+		for (int i=0;i<256;i++) {
+			counts[i+1] += counts[i];
+		}
+		for (int i=0;i<keys.size();i++) {
+			int slot = counts[(keys[i] >> shift) & 0xff]++;
+			keysTemp[slot] = keys[i];
+			valuesTemp[slot] = values[i];
+		}
+		keys.swap(keysTemp);
+		values.swap(valuesTemp);
+	}
+}
+
+template<typename K>
+static void sortChunks(std::vector<K>& keys, std::vector<int>& values, int bits, TileScheduler& scheduler) {
+	int n = keys.size();
+	// fixed chunks rather than scheduler tiles so the histograms line up between the passes.
+	// 1x1 tiles are never split
+	int chunks = std::max(1, std::min(scheduler.threads * 4, n / 4096));
+	std::vector<Tile> tiles;
+	for (int c=0;c<chunks;c++) {
+		tiles.push_back({c, 0, 1, 1});
+	}
+
+	std::vector<K> keysTemp(n);
+	std::vector<int> valuesTemp(n);
+	std::vector<int> offsets(chunks * 256);
+	for (int shift=0;shift<bits;shift+=8) {
+		scheduler.run(tiles, [&](const Tile& tile) {
+			int* count = &offsets[tile.x * 256];
+			std::fill(count, count + 256, 0);
+			for (int i=(long long)n*tile.x/chunks;i<(long long)n*(tile.x+1)/chunks;i++) {
+				count[(keys[i] >> shift) & 0xff]++;
+			}
+		});
+
+		// digit major, chunk minor keeps equal digits in their input order
+		int sum = 0;
+		for (int d=0;d<256;d++) {
+			for (int c=0;c<chunks;c++) {
+				int count = offsets[c*256 + d];
+				offsets[c*256 + d] = sum;
+				sum += count;
+			}
+		}
+
+		scheduler.run(tiles, [&](const Tile& tile) {
+			int* offset = &offsets[tile.x * 256];
+			for (int i=(long long)n*tile.x/chunks;i<(long long)n*(tile.x+1)/chunks;i++) {
+				int slot = offset[(keys[i] >> shift) & 0xff]++;
+				keysTemp[slot] = keys[i];
+				valuesTemp[slot] = values[i];
+			}
+		});
+		keys.swap(keysTemp);
+		values.swap(valuesTemp);
+	}
+}
+
+void radixSort(std::vector<unsigned int>& keys, std::vector<int>& values, int bits, TileScheduler& scheduler) {
+	sortChunks(keys, values, bits, scheduler);
+}
+
+void radixSort(std::vector<unsigned long long>& keys, std::vector<int>& values, int bits, TileScheduler& scheduler) {
+	sortChunks(keys, values, bits, scheduler);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "scheduler.hpp"
+
+#include <vector>
+
+// interleaves the low 10 bits of x, y and z into a 30 bit morton code
+unsigned int morton3(unsigned int x, unsigned int y, unsigned int z);
+
+// interleaves the low 21 bits of x, y and z into a 63 bit morton code
+unsigned long long morton3Wide(unsigned int x, unsigned int y, unsigned int z);
+
+// stable lsd radix sort of keys, values are permuted along with them
+void radixSort(std::vector<unsigned int>& keys, std::vector<int>& values, int bits = 32);
+
+// the same split into chunks across the scheduler's threads: per chunk digit histograms, one
+// prefix sum over them and a parallel scatter per 8 bit pass
+void radixSort(std::vector<unsigned int>& keys, std::vector<int>& values, int bits, TileScheduler& scheduler);
+void radixSort(std::vector<unsigned long long>& keys, std::vector<int>& values, int bits, TileScheduler& scheduler);
@@ -0,0 +1,991 @@
+#include "tracer.hpp"
+
+#include "app.hpp"
+#include "scene.hpp"
+#include "image.hpp"
+#include "intersect.hpp"
+#include "sort.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+thread_local long long tracedRays = 0;
+thread_local long long visitedNodes = 0;
+thread_local long long tracedShadowRays = 0;
+thread_local long long testedOccluders = 0;
+thread_local long long hitOccluders = 0;
+thread_local long long litPoints = 0;
+thread_local long long visitedLights = 0;
+
+void Tracer::init() {
+	width = app.width;
+	height = app.height;
+	if (threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	framebuffer.assign(width * height, glm::vec4(0.0f));
+	kernels = selectKernels(simd.empty() ? nullptr : simd.c_str());
+	scheduler.init(threads);
+}
+
+void Tracer::update(float deltaTime) {
+	if (app.renderer.animation) {
+		app.renderer.time += deltaTime;
+	}
+	app.scene.accelerator = app.renderer.accelerator;
+	app.scene.update(app.renderer.time);
+}
+
+void Tracer::draw() {
+	if (width != app.width || height != app.height) {
+		width = app.width;
+		height = app.height;
+		framebuffer.assign(width * height, glm::vec4(0.0f));
+	}
+	int slots = occluderCache ? std::min((int)app.scene.lights.size(), CACHED_LIGHTS) : 0;
+	if (occluderSlots != slots || occluders.size() != width * height * slots) {
+		occluderSlots = slots;
+		occluders.assign(width * height * slots, glm::ivec2(-1));
+	}
+
+	packed.pack(app.scene.spheres, app.scene.quads, app.scene.cubes);
+
+	inverseView = glm::inverse(app.camera.view);
+	cameraPos = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	cameraDir = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
+
+	packetStats = PacketStats();
+	raysTraced = 0;
+	nodesVisited = 0;
+	shadowRaysTraced = 0;
+	occludersTested = 0;
+	occludersHit = 0;
+	pointsLit = 0;
+	lightsVisited = 0;
+	if (streams) {
+		drawStreams();
+		return;
+	}
+	scheduler.run(width, height, [&](const Tile& tile) {
+		long long before = tracedRays;
+		long long visitedBefore = visitedNodes;
+		long long shadowsBefore = tracedShadowRays;
+		long long testedBefore = testedOccluders;
+		long long hitBefore = hitOccluders;
+		long long litBefore = litPoints;
+		long long lightsBefore = visitedLights;
+		drawTile(tile);
+		raysTraced += tracedRays - before;
+		nodesVisited += visitedNodes - visitedBefore;
+		shadowRaysTraced += tracedShadowRays - shadowsBefore;
+		occludersTested += testedOccluders - testedBefore;
+		occludersHit += hitOccluders - hitBefore;
+		pointsLit += litPoints - litBefore;
+		lightsVisited += visitedLights - lightsBefore;
+	});
+}
+
+bool Tracer::save(std::string path) {
+	return writeImage(path, width, height, framebuffer);
+}
+
+void Tracer::drawTile(const Tile& tile) {
+	// the packets test every primitive left after culling against their frustum, so they only stand
+	// in for linear traversal. with the bvh or the grid the rays go one by one
+	if (packets && app.renderer.accelerator == 0) {
+		PacketStats stats;
+		for (int y=tile.y;y<tile.y+tile.height;y+=8) {
+			for (int x=tile.x;x<tile.x+tile.width;x+=8) {
+				drawPacket(x, y, std::min(8, tile.x + tile.width - x), std::min(8, tile.y + tile.height - y), stats);
+			}
+		}
+		std::lock_guard<std::mutex> lock(statsMutex);
+		packetStats.packets += stats.packets;
+		packetStats.tests += stats.tests;
+		packetStats.culled += stats.culled;
+		packetStats.rayTests += stats.rayTests;
+		packetStats.rayHits += stats.rayHits;
+		return;
+	}
+
+	for (int y=tile.y;y<tile.y+tile.height;y++) {
+		for (int x=tile.x;x<tile.x+tile.width;x++) {
+			framebuffer[(height - 1 - y)*width + x] = render(pixelPos(x, y), y*width + x);
+		}
+	}
+}
+
+glm::vec2 Tracer::pixelPos(int x, int y) {
+	// pixel centers in the same [-1, 1] space as the fullscreen quad's uvPos
+	return glm::vec2((x + 0.5f) / width, (y + 0.5f) / height) * 2.0f - 1.0f;
+}
+
+void Tracer::drawPacket(int x0, int y0, int w, int h, PacketStats& stats) {
+	Scene& scene = app.scene;
+
+	// 8x8 primary rays sharing the camera origin, missing lanes of edge packets repeat the nearest edge ray
+	Ray rays[64];
+	RayHit hits[64];
+	bool valid[64];
+	for (int j=0;j<8;j++) {
+		for (int i=0;i<8;i++) {
+			valid[j*8 + i] = i < w && j < h;
+			rays[j*8 + i] = primaryRay(pixelPos(x0 + std::min(i, w-1), y0 + std::min(j, h-1)));
+		}
+	}
+	RayLanes lanes[8];
+	for (int j=0;j<8;j++) {
+		for (int i=0;i<8;i++) {
+			const Ray& ray = rays[j*8 + i];
+			lanes[j].ox[i] = ray.origin.x; lanes[j].oy[i] = ray.origin.y; lanes[j].oz[i] = ray.origin.z;
+			lanes[j].dx[i] = ray.direction.x; lanes[j].dy[i] = ray.direction.y; lanes[j].dz[i] = ray.direction.z;
+			lanes[j].ix[i] = ray.inverseDirection.x; lanes[j].iy[i] = ray.inverseDirection.y; lanes[j].iz[i] = ray.inverseDirection.z;
+		}
+	}
+
+	// side planes of the pyramid spanned by the corner rays, normals pointing inwards
+	glm::vec3 corners[4] = {rays[0].direction, rays[w-1].direction, rays[(h-1)*8 + w-1].direction, rays[(h-1)*8].direction};
+	glm::vec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+	glm::vec3 planes[4];
+	for (int i=0;i<4;i++) {
+		planes[i] = glm::cross(corners[i], corners[(i+1)%4]);
+		if (glm::dot(planes[i], center) < 0.0f) {
+			planes[i] = -planes[i];
+		}
+	}
+	auto visible = [&](const glm::vec4 bounds[2]) {
+		glm::vec3 lo = glm::min(glm::vec3(bounds[0]), glm::vec3(bounds[1])) - cameraPos;
+		glm::vec3 hi = glm::max(glm::vec3(bounds[0]), glm::vec3(bounds[1])) - cameraPos;
+		stats.tests++;
+		for (int i=0;i<4;i++) {
+			glm::vec3 p = glm::vec3(planes[i].x > 0.0f ? hi.x : lo.x, planes[i].y > 0.0f ? hi.y : lo.y, planes[i].z > 0.0f ? hi.z : lo.z);
+			if (glm::dot(planes[i], p) < 0.0f) {
+				stats.culled++;
+				return false;
+			}
+		}
+		return true;
+	};
+	auto count = [&](int k, float t) {
+		stats.rayTests += valid[k];
+		stats.rayHits += valid[k] && t > near;
+	};
+
+	stats.packets++;
+	tracedRays += w * h;
+	for (int k=0;k<64;k++) {
+		hits[k].distance = far + 1.0f;
+		hits[k].tint = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+		tracePlanes(rays[k], hits[k]);
+	}
+
+	for (int i=0;i<scene.spheres.size();i++) {
+		if (!visible(scene.spheres[i].bounds)) {
+			continue;
+		}
+		float sphere[4] = {packed.sphereX[i], packed.sphereY[i], packed.sphereZ[i], packed.sphereR[i]};
+		for (int j=0;j<8;j++) {
+			float t[8];
+			kernels->sphereRays(lanes[j], sphere, t);
+			for (int k=0;k<8;k++) {
+				count(j*8 + k, t[k]);
+				if (t[k] < hits[j*8 + k].distance && t[k] > near) {
+					hitSphere(rays[j*8 + k], scene.spheres[i], t[k], hits[j*8 + k]);
+				}
+			}
+		}
+	}
+
+	for (int i=0;i<scene.quads.size();i++) {
+		if (!visible(scene.quads[i].bounds)) {
+			continue;
+		}
+		for (int j=0;j<8;j++) {
+			float t[8];
+			kernels->quadRays(lanes[j], packed.quads, i, t);
+			for (int k=0;k<8;k++) {
+				count(j*8 + k, t[k]);
+				if (t[k] < hits[j*8 + k].distance && t[k] > near) {
+					hitQuad(rays[j*8 + k], scene.quads[i], t[k], hits[j*8 + k]);
+				}
+			}
+		}
+	}
+
+	for (int i=0;i<scene.cubes.size();i++) {
+		if (!visible(scene.cubes[i].bounds)) {
+			continue;
+		}
+		float bounds[6] = {packed.cubeMinX[i], packed.cubeMinY[i], packed.cubeMinZ[i], packed.cubeMaxX[i], packed.cubeMaxY[i], packed.cubeMaxZ[i]};
+		for (int j=0;j<8;j++) {
+			unsigned int mask = kernels->boxRays(lanes[j], bounds);
+			for (int k=0;k<8;k++) {
+				count(j*8 + k, (mask >> k & 1) ? 1.0f : -1.0f);
+				if (mask >> k & 1) {
+					traceCube(rays[j*8 + k], scene.cubes[i], hits[j*8 + k]);
+				}
+			}
+		}
+	}
+
+	for (int k=0;k<64;k++) {
+		traceInstances(rays[k], hits[k]);
+		traceLights(rays[k], hits[k]);
+	}
+
+	for (int i=0;i<scene.volumes.size();i++) {
+		if (!visible(scene.volumes[i].bounds)) {
+			continue;
+		}
+		for (int k=0;k<64;k++) {
+			bool overlap = intersectAABB(rays[k], scene.volumes[i].bounds);
+			count(k, overlap ? 1.0f : -1.0f);
+			if (overlap) {
+				traceVolume(rays[k], i, hits[k]);
+			}
+		}
+	}
+
+	for (int k=0;k<64;k++) {
+		if (!valid[k]) {
+			continue;
+		}
+		traceSky(rays[k], hits[k]);
+		framebuffer[(height - 1 - (y0 + k/8))*width + x0 + k%8] = shade(rays[k], hits[k], (y0 + k/8)*width + x0 + k%8);
+	}
+}
+
+void Tracer::drawStreams() {
+	Scene& scene = app.scene;
+	Renderer& settings = app.renderer;
+	int bounces = std::min(settings.bounces, MAX_BOUNCES);
+
+	// the back-to-front blend in shade() is affine in the color behind each hit, so it can be
+	// accumulated front to back: color = sum(weight * offset) + weight of the last hit
+	accum.assign(width * height, glm::vec3(0.0f));
+	stream.resize(width * height);
+	scheduler.run(width * height, [&](int begin, int end) {
+		for (int i=begin;i<end;i++) {
+			stream[i] = {primaryRay(pixelPos(i % width, i / width)), glm::vec3(1.0f), i};
+		}
+	});
+
+	for (int bounce=0;!stream.empty();bounce++) {
+		if (bounce > 0) {
+			sortStream();
+		}
+		bool reflect = settings.reflections && bounce + 1 < bounces;
+		spawned.assign(stream.size(), 0);
+		nextStream.resize(stream.size());
+
+		scheduler.run(stream.size(), [&](int begin, int end) {
+			long long before = tracedRays;
+			long long visitedBefore = visitedNodes;
+			long long shadowsBefore = tracedShadowRays;
+			long long testedBefore = testedOccluders;
+			long long hitBefore = hitOccluders;
+			long long litBefore = litPoints;
+			long long lightsBefore = visitedLights;
+			for (int i=begin;i<end;i++) {
+				StreamRay& ray = stream[i];
+				RayHit hit = trace(ray.ray);
+				if (settings.lighting && scene.lights.size() > 0 && !hit.final) {
+					hit.color = light(ray.ray.origin, hit, bounce == 0 ? ray.pixel : -1);
+				}
+
+				glm::vec3 color = glm::vec3(hit.color);
+				glm::vec3 tint = glm::vec3(hit.tint);
+				glm::vec3 scale = color * (1.0f - hit.color.a) * (1.0f - hit.tint.a);
+				glm::vec3 offset = color * hit.color.a * (1.0f - hit.tint.a) + tint * hit.tint.a;
+				accum[ray.pixel] += ray.weight * offset;
+
+				glm::vec3 weight = ray.weight * scale;
+				if (reflect && !hit.final) {
+					nextStream[i] = {Ray(hit.position, glm::reflect(ray.ray.direction, hit.normal)), weight, ray.pixel};
+					spawned[i] = 1;
+				} else {
+					accum[ray.pixel] += weight;
+				}
+			}
+			raysTraced += tracedRays - before;
+			nodesVisited += visitedNodes - visitedBefore;
+			shadowRaysTraced += tracedShadowRays - shadowsBefore;
+			occludersTested += testedOccluders - testedBefore;
+			occludersHit += hitOccluders - hitBefore;
+			pointsLit += litPoints - litBefore;
+			lightsVisited += visitedLights - lightsBefore;
+		});
+
+		int count = 0;
+		for (int i=0;i<nextStream.size();i++) {
+			if (spawned[i]) {
+				nextStream[count++] = nextStream[i];
+			}
+		}
+		nextStream.resize(count);
+		stream.swap(nextStream);
+	}
+
+	for (int i=0;i<width*height;i++) {
+		framebuffer[(height - 1 - i / width)*width + i % width] = glm::vec4(accum[i], 1.0f);
+	}
+}
+
+void Tracer::sortStream() {
+	glm::vec3 lo = glm::vec3(far);
+	glm::vec3 hi = glm::vec3(-far);
+	for (int i=0;i<stream.size();i++) {
+		lo = glm::min(lo, stream[i].ray.origin);
+		hi = glm::max(hi, stream[i].ray.origin);
+	}
+	glm::vec3 scale = 511.0f / glm::max(hi - lo, glm::vec3(0.0001f));
+
+	// direction octant first, then 9 bits per axis of morton-ordered origin
+	std::vector<unsigned int> keys(stream.size());
+	std::vector<int> order(stream.size());
+	scheduler.run(stream.size(), [&](int begin, int end) {
+		for (int i=begin;i<end;i++) {
+			const Ray& ray = stream[i].ray;
+			glm::uvec3 cell = glm::uvec3((ray.origin - lo) * scale);
+			unsigned int octant = (ray.direction.x < 0.0f) << 2 | (ray.direction.y < 0.0f) << 1 | (ray.direction.z < 0.0f);
+			keys[i] = octant << 27 | morton3(cell.x, cell.y, cell.z);
+			order[i] = i;
+		}
+	});
+	radixSort(keys, order, 30, scheduler);
+
+	nextStream.resize(stream.size());
+	for (int i=0;i<stream.size();i++) {
+		nextStream[i] = stream[order[i]];
+	}
+	stream.swap(nextStream);
+}
+
+RayHit Tracer::trace(const Ray& ray) {
+	Scene& scene = app.scene;
+
+	RayHit hit;
+	hit.distance = far + 1.0f;
+	hit.tint = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	tracedRays++;
+
+	tracePlanes(ray, hit);
+
+	if (app.renderer.accelerator == 1) {
+		traceBVH(ray, hit);
+	} else {
+		RayLane lane = toLane(ray);
+
+		float t = hit.distance;
+		int index = -1;
+		if (app.renderer.accelerator == 2) {
+			traceGrid(ray, hit);
+			t = hit.distance;
+		} else {
+			index = kernels->nearestSphere(lane, packed.spheres, near, &t);
+			if (index >= 0) {
+				hitSphere(ray, scene.spheres[index], t, hit);
+			}
+		}
+
+		index = kernels->nearestQuad(lane, packed.quads, near, &t);
+		if (index >= 0) {
+			hitQuad(ray, scene.quads[index], t, hit);
+		}
+
+		static thread_local std::vector<int> cubeIndices;
+		cubeIndices.resize(packed.cubes.count);
+		int candidates = kernels->overlapBoxes(lane, packed.cubes, cubeIndices.data());
+		for (int i=0;i<candidates;i++) {
+			traceCube(ray, scene.cubes[cubeIndices[i]], hit);
+		}
+	}
+
+	traceInstances(ray, hit);
+	traceLights(ray, hit);
+
+	for (int i=0;i<scene.volumes.size();i++) {
+		if (!intersectAABB(ray, scene.volumes[i].bounds)) {
+			continue;
+		}
+		traceVolume(ray, i, hit);
+	}
+
+	traceSky(ray, hit);
+
+	return hit;
+}
+
+// any occluder nearer than distance, for shadow rays. lights and volumes don't occlude, and the
+// traversals return at the first hit instead of searching for the closest. with a cache slot the
+// occluder found last time is tested first, and the slot is updated after a full search
+bool Tracer::traceShadow(const Ray& ray, float distance, int* cached) {
+	Scene& scene = app.scene;
+
+	RayHit hit;
+	hit.distance = distance;
+	hit.tint = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	tracedRays++;
+	tracedShadowRays++;
+	// trace() ends at the sky past far, which occludes lights beyond it
+	if (distance > far + 1.0f) {
+		return true;
+	}
+
+	if (cached && *cached >= 0) {
+		testedOccluders++;
+		if (occludes(ray, *cached, distance)) {
+			hitOccluders++;
+			return true;
+		}
+	}
+	int occluder = -1;
+	int* found = cached ? cached : &occluder;
+	*found = -1;
+
+	for (int i=0;i<scene.planes.size();i++) {
+		float t = intersectPlane(ray, scene.planes[i].normal);
+		if (t < distance && t > near) {
+			*found = PLANE << BVH::TYPE_SHIFT | i;
+			return true;
+		}
+	}
+
+	if (app.renderer.accelerator == 1) {
+		traceBVH(ray, hit, found);
+	} else {
+		RayLane lane = toLane(ray);
+		float t = distance;
+		int index = -1;
+		if (app.renderer.accelerator == 2) {
+			traceGrid(ray, hit, found);
+		} else if ((index = kernels->nearestSphere(lane, packed.spheres, near, &t)) >= 0) {
+			*found = BVH::SPHERE << BVH::TYPE_SHIFT | index;
+			return true;
+		}
+		if (hit.distance < distance) {
+			return true;
+		}
+		if ((index = kernels->nearestQuad(lane, packed.quads, near, &t)) >= 0) {
+			*found = BVH::QUAD << BVH::TYPE_SHIFT | index;
+			return true;
+		}
+
+		static thread_local std::vector<int> cubeIndices;
+		cubeIndices.resize(packed.cubes.count);
+		int candidates = kernels->overlapBoxes(lane, packed.cubes, cubeIndices.data());
+		for (int i=0;i<candidates;i++) {
+			traceCube(ray, scene.cubes[cubeIndices[i]], hit);
+			if (hit.distance < distance) {
+				*found = BVH::CUBE << BVH::TYPE_SHIFT | cubeIndices[i];
+				return true;
+			}
+		}
+	}
+	if (hit.distance < distance) {
+		return true;
+	}
+
+	traceInstances(ray, hit, found);
+	return hit.distance < distance;
+}
+
+// whether a cached occluder still blocks the shadow ray. the scene may have changed since it was
+// stored, so indices past the end just miss
+bool Tracer::occludes(const Ray& ray, int occluder, float distance) {
+	Scene& scene = app.scene;
+	int type = occluder >> BVH::TYPE_SHIFT;
+	int index = occluder & BVH::INDEX_MASK;
+	RayHit hit;
+	hit.distance = distance;
+	if (type == PLANE) {
+		if (index >= scene.planes.size()) {
+			return false;
+		}
+		float t = intersectPlane(ray, scene.planes[index].normal);
+		return t < distance && t > near;
+	}
+	if (type == BVH::INSTANCE) {
+		if (index >= scene.instances.size()) {
+			return false;
+		}
+		traceInstance(ray, index, hit, true);
+		return hit.distance < distance;
+	}
+	int count = type == BVH::SPHERE ? scene.spheres.size() : type == BVH::QUAD ? scene.quads.size() : scene.cubes.size();
+	if (index >= count) {
+		return false;
+	}
+	traceReference(ray, occluder, scene.spheres, scene.quads, scene.cubes, hit);
+	return hit.distance < distance;
+}
+
+void Tracer::tracePlanes(const Ray& ray, RayHit& hit) {
+	Scene& scene = app.scene;
+	for (int i=0;i<scene.planes.size();i++) {
+		float t = intersectPlane(ray, scene.planes[i].normal);
+		if (t < hit.distance && t > near) {
+			hit.distance = t;
+			hit.position = ray.origin + ray.direction * hit.distance;
+			hit.normal = glm::vec3(scene.planes[i].normal);
+			if (glm::dot(ray.direction, hit.normal) > 0.0f) {
+				hit.normal = -hit.normal;
+			}
+			hit.color = scene.palette.colors[scene.planes[i].colorIndex];
+			hit.material = scene.palette.materials[scene.planes[i].materialIndex];
+			hit.final = false;
+		}
+	}
+}
+
+bool Tracer::overlapNode(const Ray& ray, const BVHNode& node, float distance, float& entry) {
+	glm::vec2 range = intersectBounds(ray, node.min, node.max);
+	entry = range.x;
+	return range.x <= range.y && range.y > near && range.x < distance;
+}
+
+// stack traversal shared by the scene, instance and prefab bvhs, same as traceBVH in shader.frag.
+// leaf is called with every reference in the leaves the ray reaches before hit.distance. with any set
+// it returns after the first leaf that shortened hit.distance
+template<typename F>
+void Tracer::traverse(const Ray& ray, const std::vector<BVHNode>& nodes, const std::vector<int>& references, int root, RayHit& hit, bool any, F leaf) {
+	float limit = hit.distance;
+	float entry;
+	if (root < 0 || root >= nodes.size() || !overlapNode(ray, nodes[root], hit.distance, entry)) {
+		return;
+	}
+	int stack[BVH::MAX_DEPTH];
+	int top = 0;
+	int node = root;
+	while (true) {
+		const BVHNode& current = nodes[node];
+		visitedNodes++;
+		if (current.count > 0) {
+			for (int k=current.start;k<current.start+current.count;k++) {
+				leaf(references[k]);
+			}
+			if (any && hit.distance < limit) {
+				return;
+			}
+		} else {
+			int left = current.start;
+			float leftEntry, rightEntry;
+			bool hitLeft = overlapNode(ray, nodes[left], hit.distance, leftEntry);
+			bool hitRight = overlapNode(ray, nodes[left + 1], hit.distance, rightEntry);
+			if (hitLeft && hitRight) {
+				node = leftEntry <= rightEntry ? left : left + 1;
+				stack[top++] = leftEntry <= rightEntry ? left + 1 : left;
+				continue;
+			}
+			if (hitLeft || hitRight) {
+				node = hitLeft ? left : left + 1;
+				continue;
+			}
+		}
+		if (top == 0) {
+			break;
+		}
+		node = stack[--top];
+	}
+}
+
+// with an occluder to fill in, returns at the first hit like traceShadow wants
+void Tracer::traceBVH(const Ray& ray, RayHit& hit, int* occluder) {
+	Scene& scene = app.scene;
+	if (!scene.bvh.wideNodes.empty()) {
+		traceWide(ray, hit, occluder);
+		return;
+	}
+	traverse(ray, scene.bvh.nodes, scene.bvh.references, 0, hit, occluder != nullptr, [&](int reference) {
+		float before = hit.distance;
+		traceReference(ray, reference, scene.spheres, scene.quads, scene.cubes, hit);
+		if (occluder && hit.distance < before) {
+			*occluder = reference;
+		}
+	});
+}
+
+// same traversal as traceWide in shader.frag. the stack holds wide nodes and leaves, the children
+// of a node are pushed farthest first so the nearest one is popped next
+void Tracer::traceWide(const Ray& ray, RayHit& hit, int* occluder) {
+	Scene& scene = app.scene;
+	float limit = hit.distance;
+	const std::vector<WideNode>& nodes = scene.bvh.wideNodes;
+	int stack[BVH::WIDE_STACK];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int code = stack[--top];
+		visitedNodes++;
+		if (code < 0) {
+			for (int k=code&0x7fffff;k<(code&0x7fffff)+(code>>23&0xff);k++) {
+				float before = hit.distance;
+				traceReference(ray, scene.bvh.references[k], scene.spheres, scene.quads, scene.cubes, hit);
+				if (occluder && hit.distance < before) {
+					*occluder = scene.bvh.references[k];
+				}
+			}
+			if (occluder && hit.distance < limit) {
+				return;
+			}
+			continue;
+		}
+		const WideNode& node = nodes[code];
+		glm::vec3 scale = glm::vec3(glm::uintBitsToFloat((node.exponents & 0xff) << 23), glm::uintBitsToFloat((node.exponents >> 8 & 0xff) << 23), glm::uintBitsToFloat((node.exponents >> 16 & 0xff) << 23));
+		float entries[4];
+		int codes[4];
+		int count = 0;
+		for (int c=0;c<4;c++) {
+			if (node.children[c] == -1) {
+				continue;
+			}
+			glm::vec3 lo = node.origin + glm::vec3(node.lo[0] >> 8*c & 0xff, node.lo[1] >> 8*c & 0xff, node.lo[2] >> 8*c & 0xff) * scale;
+			glm::vec3 hi = node.origin + glm::vec3(node.hi[0] >> 8*c & 0xff, node.hi[1] >> 8*c & 0xff, node.hi[2] >> 8*c & 0xff) * scale;
+			glm::vec2 range = intersectBounds(ray, lo, hi);
+			if (range.x > range.y || range.y <= near || range.x >= hit.distance) {
+				continue;
+			}
+			// insertion sort, farthest first and the earlier child last on ties like traceBVH
+			int j = count++;
+			while (j > 0 && entries[j-1] <= range.x) {
+				entries[j] = entries[j-1];
+				codes[j] = codes[j-1];
+				j--;
+			}
+			entries[j] = range.x;
+			codes[j] = node.children[c];
+		}
+		for (int j=0;j<count;j++) {
+			stack[top++] = codes[j];
+		}
+	}
+}
+
+// 3d-dda through the grid cells along the ray, same as traceGrid in shader.frag. a sphere listed
+// in a cell may be hit beyond it, so the walk stops once the hit is nearer than the cell's exit
+void Tracer::traceGrid(const Ray& ray, RayHit& hit, int* occluder) {
+	Grid& grid = app.scene.grid;
+	if (grid.buckets == 0) {
+		return;
+	}
+	glm::vec2 range = intersectBounds(ray, grid.min, grid.max);
+	if (range.x > range.y || range.y <= near || range.x >= hit.distance) {
+		return;
+	}
+	float limit = hit.distance;
+	glm::ivec3 cell = grid.cell(ray.origin + ray.direction * glm::max(range.x, 0.0f));
+	glm::ivec3 step;
+	glm::vec3 next;
+	glm::vec3 delta;
+	for (int axis=0;axis<3;axis++) {
+		step[axis] = ray.direction[axis] < 0.0f ? -1 : 1;
+		float boundary = grid.min[axis] + (float)(cell[axis] + (step[axis] > 0 ? 1 : 0)) * grid.cellSize;
+		next[axis] = ray.direction[axis] == 0.0f ? 2.0f*far : (boundary - ray.origin[axis]) * ray.inverseDirection[axis];
+		delta[axis] = ray.direction[axis] == 0.0f ? 2.0f*far : grid.cellSize * glm::abs(ray.inverseDirection[axis]);
+	}
+	while (true) {
+		visitedNodes++;
+		int b = grid.bucket(cell);
+		for (int k=grid.starts[b];k<grid.starts[b + 1];k++) {
+			const Sphere& sphere = app.scene.spheres[grid.entries[k]];
+			float t = intersectSphere(ray, sphere.position);
+			if (t < hit.distance && t > near) {
+				hitSphere(ray, sphere, t, hit);
+				if (occluder) {
+					*occluder = BVH::SPHERE << BVH::TYPE_SHIFT | grid.entries[k];
+				}
+			}
+		}
+		int axis = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+		if (hit.distance <= next[axis] || next[axis] > range.y || (occluder && hit.distance < limit)) {
+			break;
+		}
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= grid.resolution[axis]) {
+			break;
+		}
+		next[axis] += delta[axis];
+	}
+}
+
+void Tracer::traceInstances(const Ray& ray, RayHit& hit, int* occluder) {
+	Scene& scene = app.scene;
+	if (app.renderer.accelerator == 1) {
+		traverse(ray, scene.tlas.nodes, scene.tlas.references, 0, hit, occluder != nullptr, [&](int reference) {
+			float before = hit.distance;
+			traceInstance(ray, reference & BVH::INDEX_MASK, hit, occluder != nullptr);
+			if (occluder && hit.distance < before) {
+				*occluder = reference;
+			}
+		});
+		return;
+	}
+	float limit = hit.distance;
+	for (int i=0;i<scene.instances.size();i++) {
+		if (intersectAABB(ray, scene.instances[i].bounds)) {
+			traceInstance(ray, i, hit, occluder != nullptr);
+			if (occluder && hit.distance < limit) {
+				*occluder = BVH::INSTANCE << BVH::TYPE_SHIFT | i;
+				return;
+			}
+		}
+	}
+}
+
+// traces the prefab bvh with the ray taken into the instance's local space. the direction is
+// not renormalized, so distances along it stay comparable with the world space hit
+void Tracer::traceInstance(const Ray& ray, int index, RayHit& hit, bool any) {
+	Scene& scene = app.scene;
+	const Instance& instance = scene.instances[index];
+	Ray local = Ray(glm::vec3(instance.inverse * glm::vec4(ray.origin, 1.0f)), glm::vec3(instance.inverse * glm::vec4(ray.direction, 0.0f)));
+	RayHit localHit = hit;
+	traverse(local, scene.prefabNodes, scene.prefabReferences, instance.root, localHit, any, [&](int reference) {
+		traceReference(local, reference, scene.prefabSpheres, scene.prefabQuads, scene.prefabCubes, localHit);
+	});
+	if (localHit.distance < hit.distance) {
+		hit = localHit;
+		hit.position = ray.origin + ray.direction * hit.distance;
+		hit.normal = glm::normalize(glm::mat3(glm::transpose(instance.inverse)) * localHit.normal);
+		if (instance.color.a >= 0.0f) {
+			hit.color = instance.color;
+		}
+	}
+}
+
+void Tracer::traceReference(const Ray& ray, int reference, const std::vector<Sphere>& spheres, const std::vector<Quad>& quads, const std::vector<Cube>& cubes, RayHit& hit) {
+	int type = reference >> BVH::TYPE_SHIFT;
+	int index = reference & BVH::INDEX_MASK;
+	if (type == BVH::SPHERE) {
+		float t = intersectSphere(ray, spheres[index].position);
+		if (t < hit.distance && t > near) {
+			hitSphere(ray, spheres[index], t, hit);
+		}
+	} else if (type == BVH::QUAD) {
+		const Quad& quad = quads[index];
+		if (!intersectAABB(ray, quad.bounds)) {
+			return;
+		}
+		float t = intersectQuad(ray, quad.position, quad.edges[0], quad.edges[1], quad.normal);
+		if (t < hit.distance && t > near) {
+			hitQuad(ray, quad, t, hit);
+		}
+	} else if (intersectAABB(ray, cubes[index].bounds)) {
+		traceCube(ray, cubes[index], hit);
+	}
+}
+
+void Tracer::hitSphere(const Ray& ray, const Sphere& sphere, float t, RayHit& hit) {
+	hit.distance = t;
+	hit.position = ray.origin + ray.direction * hit.distance;
+	hit.normal = glm::normalize(hit.position - glm::vec3(sphere.position));
+	hit.color = app.scene.palette.colors[sphere.colorIndex];
+	hit.material = app.scene.palette.materials[sphere.materialIndex];
+	hit.final = false;
+}
+
+void Tracer::hitQuad(const Ray& ray, const Quad& quad, float t, RayHit& hit) {
+	hit.distance = t;
+	hit.position = ray.origin + ray.direction * hit.distance;
+	hit.normal = glm::vec3(quad.normal);
+	if (glm::dot(ray.direction, hit.normal) > 0.0f) {
+		hit.normal = -hit.normal;
+	}
+	hit.color = app.scene.palette.colors[quad.colorIndex];
+	hit.material = app.scene.palette.materials[quad.materialIndex];
+	hit.final = false;
+}
+
+void Tracer::traceCube(const Ray& ray, const Cube& cube, RayHit& hit) {
+	for (int j=0;j<6;j++) {
+		float t = intersectBoxFace(ray, cube.position, cube.edges, cube.normals, j);
+		if (t < hit.distance && t > near) {
+			glm::vec3 normal = boxFaceNormal(cube.normals, j);
+			if (glm::dot(ray.direction, normal) > 0.0f) {
+				continue;
+			}
+			hit.distance = t;
+			hit.position = ray.origin + ray.direction * hit.distance;
+			hit.normal = normal;
+			hit.color = app.scene.palette.colors[cube.colorIndex];
+			hit.material = app.scene.palette.materials[cube.materialIndex];
+			hit.final = false;
+		}
+	}
+}
+
+void Tracer::traceLights(const Ray& ray, RayHit& hit) {
+	Scene& scene = app.scene;
+	for (int i=0;i<scene.lights.size();i++) {
+		glm::vec3 pos = glm::vec3(scene.lights[i].position) - ray.origin;
+		if (hit.distance > glm::length(pos) && glm::dot(ray.direction, glm::normalize(pos)) > 0.9999f) {
+			hit.distance = glm::length(pos);
+			hit.position = ray.origin + ray.direction * glm::length(pos);
+			hit.normal = -glm::normalize(pos);
+			hit.color = glm::vec4(glm::vec3(scene.lights[i].color), 1.0f);
+			hit.material = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+			hit.final = true;
+		}
+	}
+}
+
+void Tracer::traceVolume(const Ray& ray, int index, RayHit& hit) {
+	Volume& volume = app.scene.volumes[index];
+	float t[6];
+	for (int j=0;j<6;j++) {
+		t[j] = intersectBoxFace(ray, volume.position, volume.edges, volume.normals, j);
+	}
+	float s[2];
+	int k = 0;
+	for (int j=0;j<6;j++) {
+		if (t[j] < hit.distance && t[j] > near && k < 2) {
+			s[k] = t[j];
+			k++;
+		}
+	}
+	if (k == 1) {
+		s[1] = 0.0f;
+		k++;
+	}
+	if (k == 2) {
+		float d = glm::abs(s[0] - s[1]);
+		hit.tint = glm::vec4(glm::vec3(volume.color), glm::min(d * volume.color.a, 1.0f));
+	}
+}
+
+void Tracer::traceSky(const Ray& ray, RayHit& hit) {
+	if (hit.distance > far || hit.distance < near) {
+		glm::vec4 skyColor = app.scene.skyColor;
+		hit.distance = far + 1.0f;
+		hit.position = ray.origin + ray.direction * hit.distance;
+		hit.normal = -ray.direction;
+		float skyAngle = (-hit.normal.y + 1.0f) / 2.0f;
+		hit.color = glm::vec4(glm::mix(glm::vec3(skyColor)*skyColor.a, glm::vec3(skyColor), skyAngle), 1.0f);
+		hit.material = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+		hit.final = true;
+	}
+}
+
+Ray Tracer::primaryRay(glm::vec2 uvPos) {
+	glm::vec2 uv = uvPos;
+	uv.y *= float(height)/float(width);
+
+	glm::vec3 rayOffset = glm::vec3(inverseView * glm::vec4(uv, 0.0f, 0.0f));
+	glm::vec3 rayDir = glm::normalize(cameraDir + rayOffset * (float)app.camera.fov / 180.0f * PI);
+	return Ray(cameraPos, rayDir);
+}
+
+glm::vec4 Tracer::render(glm::vec2 uvPos, int pixel) {
+	Ray ray = primaryRay(uvPos);
+	return shade(ray, trace(ray), pixel);
+}
+
+// pixel indexes the occluder cache for the primary hit, -1 skips it
+glm::vec4 Tracer::shade(const Ray& ray, const RayHit& hit, int pixel) {
+	Scene& scene = app.scene;
+	Renderer& settings = app.renderer;
+
+	int lastHit = 0;
+	int bounces = std::min(settings.bounces, MAX_BOUNCES);
+	Ray rays[MAX_BOUNCES];
+	RayHit hits[MAX_BOUNCES];
+
+	glm::vec3 rayDir;
+	rays[0] = ray;
+	hits[0] = hit;
+
+	if (settings.reflections && !hits[0].final) {
+		for (int i=1;i<bounces;i++) {
+			lastHit = i;
+			rayDir = glm::reflect(rays[i-1].direction, hits[i-1].normal);
+			rays[i] = Ray(hits[i-1].position, rayDir);
+			hits[i] = trace(rays[i]);
+			if (hits[i].final) {
+				break;
+			}
+		}
+	}
+
+	if (settings.lighting && scene.lights.size() > 0) {
+		glm::vec3 prevPos = ray.origin;
+		for (int i=0;i<=lastHit;i++) {
+			if (hits[i].final) {
+				continue;
+			}
+			hits[i].color = light(prevPos, hits[i], i == 0 ? pixel : -1);
+			prevPos = hits[i].position;
+		}
+	}
+
+	glm::vec4 color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+
+	for (int i=lastHit;i>=0;i--) {
+		color = color * hits[i].color;
+		color = glm::vec4(glm::mix(glm::vec3(color), glm::vec3(hits[i].color), hits[i].color.a), 1.0f);
+		color = glm::vec4(glm::mix(glm::vec3(color), glm::vec3(hits[i].tint), hits[i].tint.a), 1.0f);
+	}
+
+	return color;
+}
+
+// the lights without a radius, then the ones whose radius reaches into the hit's cell of the light grid
+glm::vec4 Tracer::light(glm::vec3 prevPos, const RayHit& hit, int pixel) {
+	Scene& scene = app.scene;
+	Renderer& settings = app.renderer;
+
+	glm::vec3 sum = glm::vec3(0.0f, 0.0f, 0.0f);
+	auto add = [&](int j) {
+		Light& light = scene.lights[j];
+		int* cached = nullptr;
+		if (pixel >= 0 && occluderSlots > 0 && !occluders.empty()) {
+			// a slot stays with the light whose occluder it holds until that light is lit again
+			glm::ivec2& entry = occluders[pixel*occluderSlots + j % occluderSlots];
+			if (entry.x == j || entry.y < 0) {
+				entry.x = j;
+				cached = &entry.y;
+			}
+		}
+		float distance = glm::length(glm::vec3(light.position) - hit.position);
+		float falloff = light.falloff(distance);
+		visitedLights++;
+		if (falloff <= 0.0f) {
+			return;
+		}
+		glm::vec3 lightDir = glm::normalize(glm::vec3(light.position) - hit.position);
+		glm::vec3 viewDir = glm::normalize(prevPos - hit.position);
+		glm::vec3 halfwayDir = glm::normalize(lightDir + viewDir);
+
+		float diffuseFactor = glm::max(glm::dot(hit.normal, lightDir), 0.0f);
+		float specularFactor = glm::max(glm::dot(hit.normal, halfwayDir), 0.0f) * glm::max(glm::sign(diffuseFactor), 0.0f);
+
+		if (settings.shadows && diffuseFactor + specularFactor > 0.0f) {
+			Ray shadowRay = Ray(hit.position, lightDir);
+			if (traceShadow(shadowRay, distance, cached)) {
+				diffuseFactor = 0.0f;
+				specularFactor = 0.0f;
+			}
+		}
+
+		glm::vec3 ambient = glm::vec3(light.color) * hit.material.x * light.material.x;
+		glm::vec3 diffuse = glm::vec3(light.color) * diffuseFactor * hit.material.y * light.material.y;
+		glm::vec3 specular = glm::vec3(light.color) * glm::pow(specularFactor, hit.material.w * light.material.w * 2.0f) * hit.material.z * light.material.z;
+		glm::vec3 phong = (ambient + diffuse + specular) * glm::vec3(hit.color);
+
+		sum += phong * falloff;
+	};
+	litPoints++;
+	for (int k=0;k<scene.globalLights.size();k++) {
+		add(scene.globalLights[k]);
+	}
+	int b = scene.lightGrid.find(hit.position);
+	if (b >= 0) {
+		for (int k=scene.lightGrid.starts[b];k<scene.lightGrid.starts[b + 1];k++) {
+			add(scene.lightGrid.entries[k]);
+		}
+	}
+	return glm::vec4(glm::mix(glm::vec3(hit.color), sum, hit.color.a), hit.color.a);
+}
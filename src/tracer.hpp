@@ -0,0 +1,109 @@
+#pragma once
+
+#include "intersect.hpp"
+#include "bvh.hpp"
+#include "packed.hpp"
+#include "simd.hpp"
+#include "scheduler.hpp"
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct PacketStats {
+	long long packets = 0;
+	long long tests = 0; // primitive against packet frustum
+	long long culled = 0; // of which outside the frustum
+	long long rayTests = 0; // ray against primitive, after culling
+	long long rayHits = 0; // of which hit
+};
+
+struct StreamRay {
+	Ray ray;
+	glm::vec3 weight; // product of the transmittances of the hits before it
+	int pixel;
+};
+
+class Tracer {
+public:
+	const float far = 10000.0f;
+	const float near = 0.001f;
+	const float PI = 3.1415926f;
+	static constexpr int MAX_BOUNCES = 100;
+	static constexpr int PLANE = 4; // occluder type next to the bvh reference types
+	static constexpr int CACHED_LIGHTS = 8; // most occluder cache slots per pixel
+
+	int width = 0;
+	int height = 0;
+	int threads = 0; // 0 = all cores
+	std::string simd = ""; // scalar, sse4, avx2, empty = widest supported
+	const Kernels* kernels = nullptr;
+	PackedScene packed;
+	TileScheduler scheduler;
+
+	bool packets = false; // 8x8 primary ray packets with frustum culling, in place of linear traversal
+	PacketStats packetStats; // last frame
+	std::mutex statsMutex;
+
+	bool streams = false; // breadth-first bounces over sorted ray streams
+	std::vector<StreamRay> stream;
+	std::vector<StreamRay> nextStream;
+	std::vector<unsigned char> spawned;
+	std::vector<glm::vec3> accum;
+
+	std::atomic<long long> raysTraced = 0; // last frame, including shadow rays
+	std::atomic<long long> nodesVisited = 0; // last frame, bvh nodes and leaves popped in traversal
+	std::atomic<long long> shadowRaysTraced = 0; // last frame, of raysTraced
+
+	// last occluder of the primary hit's shadow ray per pixel and light, -1 when it was lit. light j
+	// uses slot j % occluderSlots of the pixel, tagged with the light that filled it
+	bool occluderCache = false;
+	int occluderSlots = 0; // per pixel, up to CACHED_LIGHTS
+	std::vector<glm::ivec2> occluders; // light, occluder
+	std::atomic<long long> occludersTested = 0; // last frame, shadow rays with a cached occluder
+	std::atomic<long long> occludersHit = 0; // of which it still occluded
+	std::atomic<long long> pointsLit = 0; // last frame, hits shaded by light()
+	std::atomic<long long> lightsVisited = 0; // lights those looked at, from the light grid or unbounded
+	std::vector<glm::vec4> framebuffer; // rgba, top row first
+
+	glm::mat4 inverseView;
+	glm::vec3 cameraPos;
+	glm::vec3 cameraDir;
+
+	void init();
+	void update(float deltaTime);
+	void draw();
+	bool save(std::string path);
+
+	RayHit trace(const Ray& ray);
+	bool traceShadow(const Ray& ray, float distance, int* cached = nullptr);
+	bool occludes(const Ray& ray, int occluder, float distance);
+	void tracePlanes(const Ray& ray, RayHit& hit);
+	void traceBVH(const Ray& ray, RayHit& hit, int* occluder = nullptr);
+	void traceWide(const Ray& ray, RayHit& hit, int* occluder);
+	void traceGrid(const Ray& ray, RayHit& hit, int* occluder = nullptr);
+	void traceInstances(const Ray& ray, RayHit& hit, int* occluder = nullptr);
+	void traceInstance(const Ray& ray, int index, RayHit& hit, bool any);
+	void traceReference(const Ray& ray, int reference, const std::vector<Sphere>& spheres, const std::vector<Quad>& quads, const std::vector<Cube>& cubes, RayHit& hit);
+	template<typename F>
+	void traverse(const Ray& ray, const std::vector<BVHNode>& nodes, const std::vector<int>& references, int root, RayHit& hit, bool any, F leaf);
+	bool overlapNode(const Ray& ray, const BVHNode& node, float distance, float& entry);
+	void hitSphere(const Ray& ray, const Sphere& sphere, float t, RayHit& hit);
+	void hitQuad(const Ray& ray, const Quad& quad, float t, RayHit& hit);
+	void traceCube(const Ray& ray, const Cube& cube, RayHit& hit);
+	void traceLights(const Ray& ray, RayHit& hit);
+	void traceVolume(const Ray& ray, int index, RayHit& hit);
+	void traceSky(const Ray& ray, RayHit& hit);
+
+	Ray primaryRay(glm::vec2 uvPos);
+	glm::vec4 render(glm::vec2 uvPos, int pixel = -1);
+	glm::vec4 shade(const Ray& ray, const RayHit& hit, int pixel = -1);
+	glm::vec4 light(glm::vec3 prevPos, const RayHit& hit, int pixel = -1);
+	glm::vec2 pixelPos(int x, int y);
+	void drawTile(const Tile& tile);
+	void drawPacket(int x0, int y0, int w, int h, PacketStats& stats);
+	void drawStreams();
+	void sortStream();
+};